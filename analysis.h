@@ -0,0 +1,1709 @@
+#pragma once
+// Analysis: moment maps, spectral cubes and PV diagrams, integrated profiles,
+// rotation-curve fitting, redshift measurement, ensembles and Tully-Fisher catalogs
+
+// Moment maps
+// Stars are binned on a square grid in the sky plane of the display camera
+// (an orthographic view along its line of sight, GALAXY_RADIUS either side of
+// the centre) and their line-of-sight velocities, as used for the Doppler
+// shift, are reduced per pixel to moment 0 (star count), moment 1 (mean
+// velocity) and moment 2 (velocity dispersion). Each worker deposits into a
+// private grid of running sums, so binning needs no atomics; the grids are then
+// added pixel range by pixel range in parallel with SIMD adds.
+std::string momentMapPrefix;
+int momentMapSize = 512;
+
+// Maps sky-plane coordinates of world positions to grid pixels
+struct SkyGrid {
+    glm::vec4 rowX; // first two rows of the camera view matrix
+    glm::vec4 rowY;
+    int size;
+    float pixelsPerUnit;
+
+    SkyGrid(int gridSize) : size(gridSize) {
+        glm::mat4 view = cameraView();
+        rowX = glm::vec4(view[0][0], view[1][0], view[2][0], view[3][0]);
+        rowY = glm::vec4(view[0][1], view[1][1], view[2][1], view[3][1]);
+        pixelsPerUnit = gridSize / (2.0f * GALAXY_RADIUS);
+    }
+
+    // Pixel column and row of a position; false outside the grid
+    bool pixelXY(const glm::vec3& position, int& px, int& py) const {
+        float x = (rowX.x * position.x + rowX.y * position.y + rowX.z * position.z + rowX.w) * pixelsPerUnit + 0.5f * size;
+        float y = (rowY.x * position.x + rowY.y * position.y + rowY.z * position.z + rowY.w) * pixelsPerUnit + 0.5f * size;
+        if (!(x >= 0.0f && x < size && y >= 0.0f && y < size)) return false;
+        px = (int)x;
+        py = (int)y;
+        return true;
+    }
+
+    // Pixel index of a position, or -1 outside the grid
+    int64_t pixel(const glm::vec3& position) const {
+        int x, y;
+        if (!pixelXY(position, x, y)) return -1;
+        return (int64_t)y * size + x;
+    }
+
+    // Linear WCS of the two grid axes, in world units from the centre
+    std::vector<FitsAxis> axes() const {
+        FitsAxis x = { (uint64_t)size, "SKY-X", "", 0.5 * size + 0.5, 0.0, 1.0 / pixelsPerUnit };
+        FitsAxis y = { (uint64_t)size, "SKY-Y", "", 0.5 * size + 0.5, 0.0, 1.0 / pixelsPerUnit };
+        return { x, y };
+    }
+};
+
+// Running sums of one worker: count, sum of v and sum of v^2 per pixel
+struct MomentGrid {
+    std::vector<double> sums;
+
+    void resize(int size) {
+        sums.assign((size_t)size * size * 3, 0.0);
+    }
+
+    void deposit(int64_t pixel, float radialVelocity) {
+        double* s = &sums[(size_t)pixel * 3];
+        s[0] += 1.0;
+        s[1] += radialVelocity;
+        s[2] += (double)radialVelocity * radialVelocity;
+    }
+};
+
+// Bin stars [begin, end); starAt(i, position, velocity) fetches star i
+template <typename StarAt>
+void depositMoments(MomentGrid& grid, const SkyGrid& sky, const glm::vec3& observerVel, size_t begin, size_t end, StarAt starAt) {
+    glm::vec3 position, velocity;
+    for (size_t i = begin; i < end; i++) {
+        starAt(i, position, velocity);
+        int64_t pixel = sky.pixel(position);
+        if (pixel >= 0) {
+            grid.deposit(pixel, lineOfSightVelocity(velocity, observerVel));
+        }
+    }
+}
+
+// target[i] += source[i]
+void addDoubles(double* target, const double* source, size_t count) {
+    size_t i = 0;
+#ifdef RDE_HAVE_SSE2
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_pd(target + i, _mm_add_pd(_mm_loadu_pd(target + i), _mm_loadu_pd(source + i)));
+        _mm_storeu_pd(target + i + 2, _mm_add_pd(_mm_loadu_pd(target + i + 2), _mm_loadu_pd(source + i + 2)));
+    }
+#endif
+    for (; i < count; i++) {
+        target[i] += source[i];
+    }
+}
+
+// Sum every worker's array into arrays[0]
+void mergeWorkerSums(std::vector<std::vector<double>>& arrays) {
+    parallelFor(arrays[0].size(), [&](size_t begin, size_t end, unsigned int) {
+        for (size_t a = 1; a < arrays.size(); a++) {
+            addDoubles(&arrays[0][begin], &arrays[a][begin], end - begin);
+        }
+    });
+}
+
+// Sum every worker's grid into grids[0]
+void mergeMomentGrids(std::vector<MomentGrid>& grids) {
+    parallelFor(grids[0].sums.size(), [&](size_t begin, size_t end, unsigned int) {
+        for (size_t g = 1; g < grids.size(); g++) {
+            addDoubles(&grids[0].sums[begin], &grids[g].sums[begin], end - begin);
+        }
+    });
+}
+
+// Reduce a merged grid to the three moment maps and write them as FITS images
+bool writeMomentMaps(const std::string& prefix, const char* modelName, const MomentGrid& grid, const SkyGrid& sky,
+    float observerSpeed) {
+    size_t pixels = (size_t)sky.size * sky.size;
+    std::vector<float> maps[3];
+    for (auto& map : maps) {
+        map.resize(pixels);
+    }
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    parallelFor(pixels, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t pixel = begin; pixel < end; pixel++) {
+            const double* s = &grid.sums[pixel * 3];
+            maps[0][pixel] = (float)s[0];
+            if (s[0] > 0.0) {
+                double mean = s[1] / s[0];
+                maps[1][pixel] = (float)mean;
+                maps[2][pixel] = (float)sqrt(std::max(s[2] / s[0] - mean * mean, 0.0));
+            }
+            else {
+                maps[1][pixel] = nan;
+                maps[2][pixel] = nan;
+            }
+        }
+    });
+
+    static const char* units[3] = { "stars", "c", "c" };
+    static const char* types[3] = { "INTENSITY", "VRAD", "VDISP" };
+    for (int moment = 0; moment < 3; moment++) {
+        std::vector<std::string> cards;
+        cards.push_back(fitsCard("BTYPE", fitsString(types[moment]), "moment " + std::to_string(moment)));
+        cards.push_back(fitsCard("MODEL", fitsString(modelName), "rotation model"));
+        cards.push_back(fitsCard("OBSVEL", fitsNumber(observerSpeed), "observer velocity [c]"));
+        std::string path = prefix + "_" + modelName + "_mom" + std::to_string(moment) + ".fits";
+        if (!writeFitsImage(path, maps[moment].data(), sky.axes(), units[moment], cards)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bin stars in memory into one grid per worker and merge them into grids[0]
+void binMomentsOfStars(const std::vector<Star>& stars, float observerSpeed, const SkyGrid& sky, std::vector<MomentGrid>& grids) {
+    glm::vec3 observerVel(0.0f, 0.0f, observerSpeed);
+    for (auto& grid : grids) {
+        grid.resize(sky.size);
+    }
+    parallelFor((unsigned int)grids.size(), stars.size(), [&](size_t begin, size_t end, unsigned int worker) {
+        depositMoments(grids[worker], sky, observerVel, begin, end, [&](size_t i, glm::vec3& position, glm::vec3& velocity) {
+            position = stars[i].position;
+            velocity = stars[i].velocity;
+        });
+    });
+    mergeMomentGrids(grids);
+}
+
+// Moment maps of the stars in memory
+bool writeMomentMapsOfStars(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+    SkyGrid sky(momentMapSize);
+    std::vector<MomentGrid> grids(workerThreadCount(ctx.threads));
+
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        binMomentsOfStars(starsForModel(ctx, model), ctx.observerVelocity, sky, grids);
+        if (!writeMomentMaps(momentMapPrefix, model == MODEL_KEPLERIAN ? "keplerian" : "flat", grids[0], sky, ctx.observerVelocity)) {
+            return false;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Wrote " << momentMapSize << "x" << momentMapSize << " moment maps of " << ctx.keplerianStars.size()
+        << " stars per model in " << seconds << " s" << std::endl;
+    return true;
+}
+
+// Spectral cubes
+// Every star emits its Gaussian lines, Doppler shifted by its line-of-sight
+// velocity, into an (x, y, wavelength) cube over the same sky grid as the
+// moment maps. Stars are first sorted by CUBE_TILE x CUBE_TILE
+// pixel tile (a parallel counting sort), then workers take whole tiles: a tile
+// holds every channel of its pixels contiguously, so all the writes of a tile
+// stay in cache and no two workers ever touch the same memory.
+// A cube larger than cubeMemoryBytes is built in slabs of consecutive channels,
+// each written out before the next is deposited, so memory use is bounded by
+// the slab size whatever the cube size.
+// A position-velocity diagram sums the cube over the pixels inside a slit
+// through the centre at position angle slitAngle (degrees from the sky x axis
+// towards y), binned by offset along the slit.
+const int CUBE_TILE = 8;
+const int CUBE_TILE_PIXELS = CUBE_TILE * CUBE_TILE;
+const float CUBE_PROFILE_SIGMAS = 4.0f; // line profiles are truncated beyond this
+
+std::string cubePath;
+int cubeSize = 128;
+int cubeChannels = 256;
+float cubeWavelengthMin = 300.0f; // nm
+float cubeWavelengthMax = 1400.0f;
+float cubeRestWavelength = 656.28f; // H-alpha
+float cubeLineWidth = 4.0f; // Gaussian sigma, nm
+uint64_t cubeMemoryBytes = 512ull << 20;
+bool pvSlit = false;
+float slitAngle = 0.0f;
+float slitWidth = 1.0f; // world units
+
+struct SpectralAxis {
+    int channels;
+    double start;     // centre of the first channel, nm
+    double increment; // nm per channel
+
+    SpectralAxis() : channels(cubeChannels), start(0.0), increment((cubeWavelengthMax - cubeWavelengthMin) / cubeChannels) {
+        start = cubeWavelengthMin + 0.5 * increment;
+    }
+
+    float channel(double wavelength) const {
+        return (float)((wavelength - start) / increment);
+    }
+
+    FitsAxis axis() const {
+        return { (uint64_t)channels, "WAVE", "nm", 1.0, start, increment };
+    }
+};
+
+// Spectral lines
+// Stars emit (positive strength) or absorb (negative strength) a list of lines,
+// by default the single line at cubeRestWavelength. Spectra are continuum
+// subtracted, so absorption lines come out negative. All lines of a star share
+// its Doppler factor, so their channels are one multiply-subtract per line,
+// done four lines at a time with SSE2.
+const int MAX_SPECTRAL_LINES = 64;
+
+struct SpectralLine {
+    std::string name;
+    float rest;     // nm
+    float strength; // channel sum of the line per star
+};
+
+std::vector<SpectralLine> spectralLines; // empty = one line at cubeRestWavelength
+
+// Strong optical lines of an HII region, relative to H-alpha
+const SpectralLine NEBULAR_LINES[] = {
+    { "H-beta", 486.13f, 0.35f },
+    { "[OIII]4959", 495.89f, 0.12f },
+    { "[OIII]5007", 500.68f, 0.35f },
+    { "[NII]6548", 654.80f, 0.10f },
+    { "H-alpha", 656.28f, 1.00f },
+    { "[NII]6583", 658.34f, 0.30f },
+    { "[SII]6716", 671.64f, 0.12f },
+    { "[SII]6731", 673.08f, 0.09f },
+};
+
+// Read "name rest_nm strength" rows ('#' starts a comment), or the built-in "nebular" list
+bool loadLineList(const std::string& source) {
+    spectralLines.clear();
+    if (source == "nebular") {
+        spectralLines.assign(std::begin(NEBULAR_LINES), std::end(NEBULAR_LINES));
+        return true;
+    }
+    std::ifstream file(source);
+    if (!file) {
+        std::cerr << "Cannot open line list " << source << std::endl;
+        return false;
+    }
+    std::string text;
+    int row = 0;
+    while (std::getline(file, text)) {
+        row++;
+        text = text.substr(0, text.find('#'));
+        std::istringstream fields(text);
+        SpectralLine line;
+        if (!(fields >> line.name)) continue;
+        if (!(fields >> line.rest >> line.strength) || !(line.rest > 0.0f)) {
+            std::cerr << source << ":" << row << ": expected name, rest wavelength in nm and strength" << std::endl;
+            return false;
+        }
+        spectralLines.push_back(line);
+    }
+    if (spectralLines.empty() || spectralLines.size() > (size_t)MAX_SPECTRAL_LINES) {
+        std::cerr << source << ": expected 1 to " << MAX_SPECTRAL_LINES << " lines" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<SpectralLine> activeSpectralLines() {
+    if (spectralLines.empty()) {
+        return { { "line", cubeRestWavelength, 1.0f } };
+    }
+    return spectralLines;
+}
+
+// Header cards describing the line list
+void addLineListCards(std::vector<std::string>& cards) {
+    std::vector<SpectralLine> lines = activeSpectralLines();
+    cards.push_back(fitsCard("NLINES", fitsInteger(lines.size()), "emission and absorption lines"));
+    for (size_t l = 0; l < lines.size(); l++) {
+        std::string n = std::to_string(l + 1);
+        cards.push_back(fitsCard("LNAME" + n, fitsString(lines[l].name), "line name"));
+        cards.push_back(fitsCard("LREST" + n, fitsNumber(lines[l].rest), "rest wavelength [nm]"));
+        cards.push_back(fitsCard("LSTREN" + n, fitsNumber(lines[l].strength), "strength per star"));
+    }
+    cards.push_back(fitsCard("LINESIG", fitsNumber(cubeLineWidth), "line Gaussian sigma [nm]"));
+}
+
+// Line list laid out for computing every line's channel from a Doppler factor
+struct LineSet {
+    int count;
+    int padded; // count rounded up to a multiple of 4
+    alignas(16) float restChannels[MAX_SPECTRAL_LINES]; // rest wavelength / channel increment
+    alignas(16) float strengths[MAX_SPECTRAL_LINES];
+    float startChannels; // first channel centre / channel increment
+    float minRest, maxRest;
+
+    LineSet(double start, double increment) {
+        std::vector<SpectralLine> lines = activeSpectralLines();
+        count = (int)lines.size();
+        padded = (count + 3) & ~3;
+        minRest = maxRest = lines[0].rest;
+        for (int l = 0; l < padded; l++) {
+            restChannels[l] = l < count ? (float)(lines[l].rest / increment) : 0.0f;
+            strengths[l] = l < count ? lines[l].strength : 0.0f;
+            if (l < count) {
+                minRest = std::min(minRest, lines[l].rest);
+                maxRest = std::max(maxRest, lines[l].rest);
+            }
+        }
+        startChannels = (float)(start / increment);
+    }
+
+    // Channel of every line (0 = centre of the first channel) for a Doppler factor
+    void channels(float dopplerFactor, float* out) const {
+#ifdef RDE_HAVE_SSE2
+        const __m128 factor = _mm_set1_ps(dopplerFactor);
+        const __m128 start = _mm_set1_ps(startChannels);
+        for (int l = 0; l < padded; l += 4) {
+            _mm_store_ps(out + l, _mm_sub_ps(_mm_mul_ps(factor, _mm_load_ps(restChannels + l)), start));
+        }
+#else
+        for (int l = 0; l < count; l++) {
+            out[l] = dopplerFactor * restChannels[l] - startChannels;
+        }
+#endif
+    }
+};
+
+// A star's lines, located in its tile
+struct CubeDeposit {
+    uint32_t pixel;      // within the tile, y * CUBE_TILE + x
+    float dopplerFactor; // shifts every line of the star
+};
+
+// Sort the stars' lines by tile; tileStart[t] .. tileStart[t + 1] index deposits of tile t
+void sortCubeDeposits(const std::vector<Star>& stars, float observerSpeed, const SkyGrid& sky, const SpectralAxis& spectral,
+    int tilesPerRow, std::vector<CubeDeposit>& deposits, std::vector<uint64_t>& tileStart) {
+    size_t tileCount = (size_t)tilesPerRow * tilesPerRow;
+    unsigned int workers = workerThreadCount();
+    glm::vec3 observerVel(0.0f, 0.0f, observerSpeed);
+    float reach = CUBE_PROFILE_SIGMAS * cubeLineWidth / (float)spectral.increment;
+    LineSet lines(spectral.start, spectral.increment);
+
+    // Pass 1: each star's lines and tile (-1 when it falls outside the cube), and per-worker tile counts
+    std::vector<int32_t> starTile(stars.size());
+    std::vector<CubeDeposit> starDeposit(stars.size());
+    std::vector<uint64_t> counts(workers * tileCount, 0);
+    parallelFor(stars.size(), [&](size_t begin, size_t end, unsigned int worker) {
+        uint64_t* count = &counts[worker * tileCount];
+        for (size_t i = begin; i < end; i++) {
+            int x, y;
+            starTile[i] = -1;
+            if (!sky.pixelXY(stars[i].position, x, y)) continue;
+            float dopplerFactor = relativisticDopplerFactor(lineOfSightVelocity(stars[i].velocity, observerVel));
+            float bluest = spectral.channel(lines.minRest * dopplerFactor);
+            float reddest = spectral.channel(lines.maxRest * dopplerFactor);
+            if (reddest + reach < 0.0f || bluest - reach > spectral.channels - 1) continue;
+            starTile[i] = (y / CUBE_TILE) * tilesPerRow + x / CUBE_TILE;
+            starDeposit[i].pixel = (uint32_t)((y % CUBE_TILE) * CUBE_TILE + x % CUBE_TILE);
+            starDeposit[i].dopplerFactor = dopplerFactor;
+            count[starTile[i]]++;
+        }
+    });
+
+    // Exclusive prefix sum in (tile, worker) order gives every worker its slots in every tile
+    tileStart.assign(tileCount + 1, 0);
+    uint64_t total = 0;
+    for (size_t tile = 0; tile < tileCount; tile++) {
+        tileStart[tile] = total;
+        for (unsigned int worker = 0; worker < workers; worker++) {
+            uint64_t count = counts[worker * tileCount + tile];
+            counts[worker * tileCount + tile] = total;
+            total += count;
+        }
+    }
+    tileStart[tileCount] = total;
+
+    // Pass 2: scatter; parallelFor hands every worker the same range again
+    deposits.resize(total);
+    parallelFor(stars.size(), [&](size_t begin, size_t end, unsigned int worker) {
+        uint64_t* next = &counts[worker * tileCount];
+        for (size_t i = begin; i < end; i++) {
+            if (starTile[i] >= 0) deposits[next[starTile[i]]++] = starDeposit[i];
+        }
+    });
+}
+
+// Add the lines of one tile to channels [firstChannel, firstChannel + slabChannels)
+// of its memory, laid out as [pixel][channel]
+void depositCubeTile(const CubeDeposit* deposits, size_t count, int firstChannel, int slabChannels,
+    const SpectralAxis& spectral, float* tile) {
+    float sigma = cubeLineWidth / (float)spectral.increment; // in channels
+    float reach = CUBE_PROFILE_SIGMAS * sigma;
+    float exponentScale = -0.5f / (sigma * sigma);
+    float peak = 1.0f / (sigma * sqrtf(2.0f * (float)M_PI)); // the channel sum of a line is about its strength
+    int lastChannel = firstChannel + slabChannels - 1;
+    LineSet lines(spectral.start, spectral.increment);
+    alignas(16) float channels[MAX_SPECTRAL_LINES];
+    for (size_t d = 0; d < count; d++) {
+        float* spectrum = tile + (size_t)deposits[d].pixel * slabChannels - firstChannel;
+        lines.channels(deposits[d].dopplerFactor, channels);
+        for (int l = 0; l < lines.count; l++) {
+            int low = std::max((int)ceilf(channels[l] - reach), firstChannel);
+            int high = std::min((int)floorf(channels[l] + reach), lastChannel);
+            float amplitude = peak * lines.strengths[l];
+            for (int c = low; c <= high; c++) {
+                float offset = c - channels[l];
+                spectrum[c] += amplitude * expf(exponentScale * offset * offset);
+            }
+        }
+    }
+}
+
+// Bin of every pixel along the slit, or -1 outside it
+std::vector<int32_t> slitBins(const SkyGrid& sky) {
+    std::vector<int32_t> bins((size_t)sky.size * sky.size, -1);
+    float angle = glm::radians(slitAngle);
+    float cosAngle = cosf(angle), sinAngle = sinf(angle);
+    for (int y = 0; y < sky.size; y++) {
+        for (int x = 0; x < sky.size; x++) {
+            float skyX = (x + 0.5f - 0.5f * sky.size) / sky.pixelsPerUnit;
+            float skyY = (y + 0.5f - 0.5f * sky.size) / sky.pixelsPerUnit;
+            float along = skyX * cosAngle + skyY * sinAngle;
+            float across = -skyX * sinAngle + skyY * cosAngle;
+            int bin = (int)floorf(along * sky.pixelsPerUnit + 0.5f * sky.size);
+            if (fabsf(across) <= 0.5f * slitWidth && bin >= 0 && bin < sky.size) {
+                bins[(size_t)y * sky.size + x] = bin;
+            }
+        }
+    }
+    return bins;
+}
+
+// Build, write and slice the cube of one model
+bool writeSpectralCube(const SimulationContext& ctx, int model, const SkyGrid& sky, const SpectralAxis& spectral) {
+    const char* modelName = model == MODEL_KEPLERIAN ? "keplerian" : "flat";
+    int tilesPerRow = (sky.size + CUBE_TILE - 1) / CUBE_TILE;
+    size_t tileCount = (size_t)tilesPerRow * tilesPerRow;
+
+    std::vector<CubeDeposit> deposits;
+    std::vector<uint64_t> tileStart;
+    sortCubeDeposits(starsForModel(ctx, model), ctx.observerVelocity, sky, spectral, tilesPerRow, deposits, tileStart);
+
+    size_t channelBytes = tileCount * CUBE_TILE_PIXELS * sizeof(float);
+    int slabChannels = (int)std::min<uint64_t>(spectral.channels, std::max<uint64_t>(cubeMemoryBytes / channelBytes, 1));
+    std::vector<float> slab(tileCount * CUBE_TILE_PIXELS * slabChannels);
+
+    std::vector<std::string> cards;
+    cards.push_back(fitsCard("MODEL", fitsString(modelName), "rotation model"));
+    cards.push_back(fitsCard("OBSVEL", fitsNumber(ctx.observerVelocity), "observer velocity [c]"));
+    addLineListCards(cards);
+
+    std::vector<FitsAxis> axes = sky.axes();
+    axes.push_back(spectral.axis());
+    FitsWriter writer;
+    if (!writer.open(withSuffix(cubePath, std::string("_") + modelName), axes, "stars", cards)) {
+        return false;
+    }
+
+    // Each worker sums its rows of a plane into its own slit row, merged per channel
+    std::vector<int32_t> bins;
+    std::vector<float> pv;
+    std::vector<std::vector<double>> pvSums;
+    if (pvSlit) {
+        bins = slitBins(sky);
+        pv.assign((size_t)sky.size * spectral.channels, 0.0f);
+        pvSums.assign(workerThreadCount(ctx.threads), std::vector<double>(sky.size));
+    }
+
+    std::vector<float> plane((size_t)sky.size * sky.size);
+    for (int firstChannel = 0; firstChannel < spectral.channels; firstChannel += slabChannels) {
+        int channels = std::min(slabChannels, spectral.channels - firstChannel);
+
+        // Tiles are handed out one at a time, as the dense centre tiles take much longer
+        std::atomic<size_t> nextTile(0);
+        parallelFor(ctx.threads, workerThreadCount(ctx.threads), [&](size_t, size_t, unsigned int) {
+            for (size_t tile = nextTile++; tile < tileCount; tile = nextTile++) {
+                float* memory = &slab[tile * CUBE_TILE_PIXELS * channels];
+                std::fill(memory, memory + CUBE_TILE_PIXELS * channels, 0.0f);
+                depositCubeTile(&deposits[tileStart[tile]], tileStart[tile + 1] - tileStart[tile],
+                    firstChannel, channels, spectral, memory);
+            }
+        });
+
+        // Untile the slab one channel plane at a time, in FITS order
+        for (int c = 0; c < channels; c++) {
+            for (auto& sums : pvSums) {
+                std::fill(sums.begin(), sums.end(), 0.0);
+            }
+            parallelFor(ctx.threads, sky.size, [&](size_t begin, size_t end, unsigned int worker) {
+                for (size_t y = begin; y < end; y++) {
+                    for (int x = 0; x < sky.size; x++) {
+                        size_t tile = (y / CUBE_TILE) * tilesPerRow + x / CUBE_TILE;
+                        size_t pixel = (y % CUBE_TILE) * CUBE_TILE + x % CUBE_TILE;
+                        plane[y * sky.size + x] = slab[(tile * CUBE_TILE_PIXELS + pixel) * channels + c];
+                    }
+                }
+                if (!pvSlit) return;
+                std::vector<double>& sums = pvSums[worker];
+                for (size_t pixel = begin * sky.size; pixel < end * sky.size; pixel++) {
+                    if (bins[pixel] >= 0) sums[bins[pixel]] += plane[pixel];
+                }
+            });
+            writer.write(plane.data(), plane.size());
+            if (pvSlit) {
+                mergeWorkerSums(pvSums);
+                float* row = &pv[(size_t)(firstChannel + c) * sky.size];
+                for (int bin = 0; bin < sky.size; bin++) {
+                    row[bin] = (float)pvSums[0][bin];
+                }
+            }
+        }
+    }
+    if (!writer.close()) {
+        return false;
+    }
+
+    if (pvSlit) {
+        cards.push_back(fitsCard("SLITPA", fitsNumber(slitAngle), "slit position angle [deg]"));
+        cards.push_back(fitsCard("SLITWID", fitsNumber(slitWidth), "slit width [world units]"));
+        FitsAxis offset = { (uint64_t)sky.size, "OFFSET", "", 0.5 * sky.size + 0.5, 0.0, 1.0 / sky.pixelsPerUnit };
+        if (!writeFitsImage(withSuffix(cubePath, std::string("_") + modelName + "_pv"), pv.data(),
+            { offset, spectral.axis() }, "stars", cards)) {
+            return false;
+        }
+    }
+    if (slabChannels < spectral.channels) {
+        std::cout << modelName << " cube built in slabs of " << slabChannels << " channels" << std::endl;
+    }
+    return true;
+}
+
+// Spectral cubes (and PV diagrams) of both models
+bool writeSpectralCubes(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+    SkyGrid sky(cubeSize);
+    SpectralAxis spectral;
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        if (!writeSpectralCube(ctx, model, sky, spectral)) {
+            return false;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Wrote " << cubeSize << "x" << cubeSize << "x" << cubeChannels << " spectral cubes of "
+        << ctx.keplerianStars.size() << " stars per model in " << seconds << " s" << std::endl;
+    return true;
+}
+
+// Batched multi-observer Doppler kernel
+// Evaluates the Doppler factor of every star for a whole set of observer
+// velocities. A star's line of sight does not depend on the observer, so for a
+// block of DOPPLER_BLOCK_STARS stars the unit line of sight and the star's own
+// velocity along it are computed once into a small cache-resident buffer. Each
+// observer then only needs beta = own - u . lineOfSight per star, evaluated
+// four stars at a time with SSE2, and the block's factors are handed to
+// reduce(observer, firstStar, factors, count) while still in cache. Every star
+// is read from memory once for all observers and no per-star results outlive
+// their block.
+const size_t DOPPLER_BLOCK_STARS = 1024;
+
+struct LineOfSightBlock {
+    alignas(16) float own[DOPPLER_BLOCK_STARS]; // star velocity along the line of sight
+    alignas(16) float x[DOPPLER_BLOCK_STARS];   // unit line of sight
+    alignas(16) float y[DOPPLER_BLOCK_STARS];
+    alignas(16) float z[DOPPLER_BLOCK_STARS];
+    alignas(16) float factors[DOPPLER_BLOCK_STARS];
+};
+
+// Doppler factors of the block's stars for one observer velocity
+void blockDopplerFactors(LineOfSightBlock& block, size_t count, const glm::vec3& observer) {
+    size_t i = 0;
+#ifdef RDE_HAVE_SSE2
+    const __m128 ux = _mm_set1_ps(observer.x), uy = _mm_set1_ps(observer.y), uz = _mm_set1_ps(observer.z);
+    const __m128 one = _mm_set1_ps(1.0f), minusOne = _mm_set1_ps(-1.0f);
+    const __m128 limit = _mm_set1_ps(0.99f), minusLimit = _mm_set1_ps(-0.99f);
+    const __m128 invC = _mm_set1_ps(1.0f / SPEED_OF_LIGHT);
+    for (; i + 4 <= count; i += 4) {
+        __m128 projected = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, _mm_load_ps(block.x + i)),
+            _mm_mul_ps(uy, _mm_load_ps(block.y + i))), _mm_mul_ps(uz, _mm_load_ps(block.z + i)));
+        __m128 beta = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(block.own + i), projected), invC);
+        // Same clamping as relativisticDopplerFactor()
+        __m128 high = _mm_cmpge_ps(beta, one);
+        beta = _mm_or_ps(_mm_and_ps(high, limit), _mm_andnot_ps(high, beta));
+        __m128 low = _mm_cmple_ps(beta, minusOne);
+        beta = _mm_or_ps(_mm_and_ps(low, minusLimit), _mm_andnot_ps(low, beta));
+        _mm_store_ps(block.factors + i, _mm_sqrt_ps(_mm_div_ps(_mm_add_ps(one, beta), _mm_sub_ps(one, beta))));
+    }
+#endif
+    for (; i < count; i++) {
+        float projected = observer.x * block.x[i] + observer.y * block.y[i] + observer.z * block.z[i];
+        block.factors[i] = relativisticDopplerFactor(block.own[i] - projected);
+    }
+}
+
+template <typename Reduce>
+void dopplerFactorsForObservers(const std::vector<Star>& stars, size_t begin, size_t end,
+    const std::vector<glm::vec3>& observers, Reduce reduce) {
+    std::unique_ptr<LineOfSightBlock> block(new LineOfSightBlock);
+    for (size_t blockStart = begin; blockStart < end; blockStart += DOPPLER_BLOCK_STARS) {
+        size_t count = std::min(DOPPLER_BLOCK_STARS, end - blockStart);
+        for (size_t i = 0; i < count; i++) {
+            const glm::vec3& velocity = stars[blockStart + i].velocity;
+            glm::vec3 lineOfSight = glm::normalize(glm::vec3(0.0f, 0.0f, OBSERVER_POSITION_Z) - velocity);
+            block->own[i] = glm::dot(velocity, lineOfSight);
+            block->x[i] = lineOfSight.x;
+            block->y[i] = lineOfSight.y;
+            block->z[i] = lineOfSight.z;
+        }
+        for (size_t o = 0; o < observers.size(); o++) {
+            blockDopplerFactors(*block, count, observers[o]);
+            reduce(o, blockStart, (const float*)block->factors, count);
+        }
+    }
+}
+
+// updateDopplerShifts() through the batched kernel and wavelengthsToRGB(), a
+// block at a time. Factors can differ from the per-star path in the last bit,
+// as the kernel splits the line-of-sight projection between the star's and the
+// observer's velocity.
+void updateDopplerShiftsBatched(SimulationContext& ctx) {
+    PhaseTimer timer(PHASE_DOPPLER);
+    std::vector<glm::vec3> observers(1, glm::vec3(0.0f, 0.0f, ctx.observerVelocity));
+    float wavelengths[DOPPLER_BLOCK_STARS];
+    float rgb[DOPPLER_BLOCK_STARS * 3];
+    for (std::vector<Star>* modelStars : { &ctx.keplerianStars, &ctx.flatRotationStars }) {
+        std::vector<Star>& stars = *modelStars;
+        dopplerFactorsForObservers(stars, 0, stars.size(), observers, [&](size_t, size_t first, const float* factors, size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                wavelengths[i] = glm::clamp(0.5f * factors[i], 0.0f, 1.0f);
+            }
+            wavelengthsToRGB(wavelengths, rgb, count);
+            for (size_t i = 0; i < count; i++) {
+                memcpy(stars[first + i].dopplerShiftedColor, &rgb[i * 3], 3 * sizeof(float));
+            }
+        });
+    }
+}
+
+// Observer velocities along the line of sight axis, as the viewer moves
+std::vector<glm::vec3> observerStates(const std::vector<float>& velocities) {
+    std::vector<glm::vec3> observers;
+    for (float velocity : velocities) {
+        observers.push_back(glm::vec3(0.0f, 0.0f, velocity));
+    }
+    return observers;
+}
+
+// Integrated line profiles
+// The spectrum of the whole, unresolved galaxy: the sum over all stars of the
+// cube's lines, for every model and every observer velocity of a sweep.
+// One pass of the batched Doppler kernel fills, per worker, a histogram of line
+// centres weighted by line strength per observer velocity (cloud-in-cell on PROFILE_OVERSAMPLING bins per
+// channel). Convolving the merged histograms with the line shape then gives the
+// profiles, so no per-star results are ever stored.
+const int PROFILE_OVERSAMPLING = 4;
+
+std::string profilePath;
+std::vector<float> profileObserverVelocities; // empty = current observer velocity
+
+// "A,B,C" lists velocities; "MIN:MAX:N" sweeps N evenly spaced velocities
+std::vector<float> parseVelocitySweep(const std::string& text) {
+    if (text.find(':') == std::string::npos) {
+        return parseFloatList(text);
+    }
+    size_t first = text.find(':');
+    size_t second = text.find(':', first + 1);
+    if (second == std::string::npos) throw std::invalid_argument(text);
+    float low = std::stof(text.substr(0, first));
+    float high = std::stof(text.substr(first + 1, second - first - 1));
+    int count = std::stoi(text.substr(second + 1));
+    if (count <= 0) throw std::invalid_argument(text);
+    std::vector<float> velocities(count);
+    for (int i = 0; i < count; i++) {
+        velocities[i] = count == 1 ? low : low + (high - low) * i / (count - 1);
+    }
+    return velocities;
+}
+
+bool writeIntegratedProfiles(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<float> velocities = profileObserverVelocities;
+    if (velocities.empty()) {
+        velocities.push_back(ctx.observerVelocity);
+    }
+    size_t observers = velocities.size();
+    std::vector<glm::vec3> observerVels = observerStates(velocities);
+    SpectralAxis spectral;
+
+    // Fine bins cover the channels plus the reach of a line on either side,
+    // so lines centred just outside the range still add their wings
+    float sigma = cubeLineWidth / (float)spectral.increment;
+    int margin = (int)ceilf(CUBE_PROFILE_SIGMAS * sigma * PROFILE_OVERSAMPLING) + 1;
+    int bins = spectral.channels * PROFILE_OVERSAMPLING + 2 * margin;
+    auto binPosition = [&](float channel) { return (channel + 0.5f) * PROFILE_OVERSAMPLING - 0.5f + margin; };
+    LineSet lines(spectral.start, spectral.increment);
+
+    unsigned int workers = workerThreadCount(ctx.threads);
+    std::vector<float> profiles((size_t)MODEL_COUNT * observers * spectral.channels);
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        const std::vector<Star>& stars = starsForModel(ctx, model);
+        std::vector<std::vector<double>> histograms(workers, std::vector<double>(observers * bins, 0.0));
+        parallelFor(ctx.threads, stars.size(), [&](size_t begin, size_t end, unsigned int worker) {
+            alignas(16) float channels[MAX_SPECTRAL_LINES];
+            dopplerFactorsForObservers(stars, begin, end, observerVels, [&](size_t o, size_t, const float* factors, size_t count) {
+                double* histogram = &histograms[worker][o * bins];
+                for (size_t i = 0; i < count; i++) {
+                    lines.channels(factors[i], channels);
+                    for (int l = 0; l < lines.count; l++) {
+                        float position = binPosition(channels[l]);
+                        if (!(position >= 0.0f && position < bins - 1)) continue;
+                        int bin = (int)position;
+                        float fraction = position - bin;
+                        histogram[bin] += lines.strengths[l] * (1.0f - fraction);
+                        histogram[bin + 1] += lines.strengths[l] * fraction;
+                    }
+                }
+            });
+        });
+        mergeWorkerSums(histograms);
+
+        // Convolve each histogram with the line shape sampled at the channel centres
+        float exponentScale = -0.5f / (sigma * sigma);
+        float peak = 1.0f / (sigma * sqrtf(2.0f * (float)M_PI));
+        int reach = margin;
+        parallelFor(ctx.threads, observers, [&](size_t begin, size_t end, unsigned int) {
+            for (size_t o = begin; o < end; o++) {
+                const double* histogram = &histograms[0][o * bins];
+                float* profile = &profiles[((size_t)model * observers + o) * spectral.channels];
+                for (int c = 0; c < spectral.channels; c++) {
+                    float centre = binPosition((float)c);
+                    double sum = 0.0;
+                    for (int b = std::max((int)centre - reach, 0); b <= std::min((int)centre + reach + 1, bins - 1); b++) {
+                        float offset = (b - centre) / (float)PROFILE_OVERSAMPLING;
+                        sum += histogram[b] * expf(exponentScale * offset * offset);
+                    }
+                    profile[c] = (float)(sum * peak);
+                }
+            }
+        });
+    }
+
+    // Axes: wavelength, observer velocity (linear when the sweep is evenly spaced), model
+    bool evenlySpaced = observers > 1;
+    for (size_t o = 2; o < observers && evenlySpaced; o++) {
+        float step = (velocities[observers - 1] - velocities[0]) / (observers - 1);
+        evenlySpaced = fabsf(velocities[o] - velocities[0] - step * o) <= 1e-5f;
+    }
+    FitsAxis velocityAxis = { (uint64_t)observers, "OBSINDEX", "", 1.0, 1.0, 1.0 };
+    if (evenlySpaced) {
+        velocityAxis = { (uint64_t)observers, "OBSVEL", "c", 1.0, velocities[0],
+            (velocities[observers - 1] - velocities[0]) / (double)(observers - 1) };
+    }
+    FitsAxis modelAxis = { (uint64_t)MODEL_COUNT, "MODEL", "", 1.0, 1.0, 1.0 };
+
+    std::vector<std::string> cards;
+    cards.push_back(fitsCard("MODEL1", fitsString("keplerian"), "first plane"));
+    cards.push_back(fitsCard("MODEL2", fitsString("flat"), "second plane"));
+    cards.push_back(fitsCard("NSTARS", fitsInteger(ctx.keplerianStars.size()), "stars per model"));
+    addLineListCards(cards);
+    for (size_t o = 0; o < observers && o < 9999; o++) {
+        char key[16];
+        snprintf(key, sizeof(key), "OBSV%04d", (int)o + 1);
+        cards.push_back(fitsCard(key, fitsNumber(velocities[o]), "observer velocity [c]"));
+    }
+    if (!writeFitsImage(profilePath, profiles.data(), { spectral.axis(), velocityAxis, modelAxis }, "stars", cards)) {
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Wrote integrated line profiles of " << ctx.keplerianStars.size() << " stars x " << MODEL_COUNT
+        << " models x " << observers << " observer velocities in " << seconds << " s" << std::endl;
+    return true;
+}
+
+// Doppler factor statistics of both models for every observer velocity of a sweep, as CSV
+std::string dopplerSweepPath;
+
+bool writeDopplerSweep(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<float> velocities = profileObserverVelocities;
+    if (velocities.empty()) {
+        velocities.push_back(ctx.observerVelocity);
+    }
+    std::vector<glm::vec3> observers = observerStates(velocities);
+    size_t observerCount = observers.size();
+
+    FILE* file = fopen(dopplerSweepPath.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot create " << dopplerSweepPath << std::endl;
+        return false;
+    }
+    fprintf(file, "model,observer_velocity,mean_doppler_factor,stddev_doppler_factor,redshifted_fraction\n");
+
+    // Per worker and observer: sum of factors, sum of squares, count of redshifted stars
+    unsigned int workers = workerThreadCount(ctx.threads);
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        const std::vector<Star>& stars = starsForModel(ctx, model);
+        std::vector<std::vector<double>> sums(workers, std::vector<double>(observerCount * 3, 0.0));
+        parallelFor(ctx.threads, stars.size(), [&](size_t begin, size_t end, unsigned int worker) {
+            double* sum = sums[worker].data();
+            dopplerFactorsForObservers(stars, begin, end, observers, [&](size_t o, size_t, const float* factors, size_t count) {
+                double factorSum = 0.0, squareSum = 0.0, redshifted = 0.0;
+                for (size_t i = 0; i < count; i++) {
+                    factorSum += factors[i];
+                    squareSum += (double)factors[i] * factors[i];
+                    redshifted += factors[i] > 1.0f ? 1.0 : 0.0;
+                }
+                sum[o * 3 + 0] += factorSum;
+                sum[o * 3 + 1] += squareSum;
+                sum[o * 3 + 2] += redshifted;
+            });
+        });
+        mergeWorkerSums(sums);
+
+        double n = (double)std::max<size_t>(stars.size(), 1);
+        for (size_t o = 0; o < observerCount; o++) {
+            double mean = sums[0][o * 3] / n;
+            double variance = std::max(sums[0][o * 3 + 1] / n - mean * mean, 0.0);
+            fprintf(file, "%s,%.9g,%.9g,%.9g,%.9g\n", model == MODEL_KEPLERIAN ? "keplerian" : "flat",
+                velocities[o], mean, sqrt(variance), sums[0][o * 3 + 2] / n);
+        }
+    }
+    bool ok = fclose(file) == 0;
+    if (!ok) {
+        std::cerr << "Cannot write " << dopplerSweepPath << std::endl;
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Swept " << ctx.keplerianStars.size() << " stars x " << MODEL_COUNT << " models x " << observerCount
+        << " observer velocities in " << seconds << " s" << std::endl;
+    return true;
+}
+
+// Rotation-curve fitting
+// Fits a rotation curve to a moment-1 velocity map, made from the stars in
+// memory or read from a FITS file, by sampling the posterior with parallel
+// tempering. The model speed at radius r is
+//   v(r)^2 = K^2 GALAXY_RADIUS / (r + 0.1) + V^2 r^2 / (r^2 + rc^2)
+// a Keplerian term of normalization K (as the generator uses) plus a cored halo
+// that rises to the flat velocity V outside the core radius rc. Every map pixel
+// is deprojected onto the disk plane (y = 0) through the sky grid's camera, and
+// the model star velocity there is projected exactly as lineOfSightVelocity()
+// does. Pixel residuals are Gaussian with dispersion sigma / sqrt(n) for n stars.
+// Each iteration proposes a move for every temperature's chain and evaluates all
+// proposals in one parallel pass over the pixels, four pixels per SSE2
+// instruction, so each pixel is read once per iteration.
+const int FIT_PARAMETERS = 4; // K, V, rc, ln sigma
+const size_t FIT_PIXEL_BLOCK = 1024;
+
+std::string fitSource; // "keplerian", "flat" or a moment-1 FITS file
+std::string fitWeightsPath;
+std::string fitChainPath;
+int fitIterations = 4000;
+int fitTemperatures = 8;
+float fitMaxTemperature = 50.0f;
+bool fitScaling = false;
+
+const char* FIT_PARAMETER_NAMES[FIT_PARAMETERS] = { "K", "V", "rc", "ln_sigma" };
+const double FIT_PRIOR_MIN[FIT_PARAMETERS] = { 0.0, 0.0, 0.01, -12.0 };
+const double FIT_PRIOR_MAX[FIT_PARAMETERS] = { 2.0, 2.0, 20.0, 1.0 };
+
+// Deprojected map pixels
+struct RotationData {
+    std::vector<float> radius;
+    std::vector<float> tangentX; // unit tangent of a circular orbit
+    std::vector<float> tangentZ;
+    std::vector<float> velocity; // moment 1
+    std::vector<float> weight;   // stars in the pixel
+    float observerVelocity = 0.0f;
+
+    size_t size() const { return radius.size(); }
+};
+
+// Add every pixel with a velocity, deprojecting its sky position with the camera of SkyGrid
+void addRotationPixels(const std::vector<float>& velocity, const std::vector<float>& weight, uint64_t width, uint64_t height,
+    const FitsAxis& axisX, const FitsAxis& axisY, RotationData& data) {
+    SkyGrid sky(1);
+    // Sky X = a x + b z + c and Y = d x + e z + f for disk points (x, 0, z)
+    double a = sky.rowX.x, b = sky.rowX.z, c = sky.rowX.w;
+    double d = sky.rowY.x, e = sky.rowY.z, f = sky.rowY.w;
+    double determinant = a * e - b * d;
+    for (uint64_t py = 0; py < height; py++) {
+        for (uint64_t px = 0; px < width; px++) {
+            size_t pixel = (size_t)(py * width + px);
+            if (!std::isfinite(velocity[pixel]) || !(weight[pixel] > 0.0f)) continue;
+            double skyX = axisX.referenceValue + (px + 1 - axisX.referencePixel) * axisX.increment - c;
+            double skyY = axisY.referenceValue + (py + 1 - axisY.referencePixel) * axisY.increment - f;
+            double x = (e * skyX - b * skyY) / determinant;
+            double z = (a * skyY - d * skyX) / determinant;
+            double r = sqrt(x * x + z * z);
+            if (r < 1e-6) continue;
+            data.radius.push_back((float)r);
+            data.tangentX.push_back((float)(-z / r));
+            data.tangentZ.push_back((float)(x / r));
+            data.velocity.push_back(velocity[pixel]);
+            data.weight.push_back(weight[pixel]);
+        }
+    }
+}
+
+bool loadRotationData(const SimulationContext& ctx, RotationData& data) {
+    if (fitSource == "keplerian" || fitSource == "flat") {
+        SkyGrid sky(momentMapSize);
+        std::vector<MomentGrid> grids(workerThreadCount(ctx.threads));
+        binMomentsOfStars(starsForModel(ctx, fitSource == "keplerian" ? MODEL_KEPLERIAN : MODEL_FLAT_ROTATION), ctx.observerVelocity,
+            sky, grids);
+        size_t pixels = (size_t)sky.size * sky.size;
+        std::vector<float> velocity(pixels), weight(pixels);
+        for (size_t pixel = 0; pixel < pixels; pixel++) {
+            const double* s = &grids[0].sums[pixel * 3];
+            weight[pixel] = (float)s[0];
+            velocity[pixel] = s[0] > 0.0 ? (float)(s[1] / s[0]) : std::numeric_limits<float>::quiet_NaN();
+        }
+        std::vector<FitsAxis> axes = sky.axes();
+        addRotationPixels(velocity, weight, sky.size, sky.size, axes[0], axes[1], data);
+        data.observerVelocity = ctx.observerVelocity;
+    }
+    else {
+        FitsImage map;
+        if (!readFitsImage(fitSource, map)) {
+            return false;
+        }
+        if (map.axes.size() != 2) {
+            std::cerr << fitSource << " is not a 2-D velocity map" << std::endl;
+            return false;
+        }
+        std::vector<float> weight(map.data.size(), 1.0f);
+        if (!fitWeightsPath.empty()) {
+            FitsImage weights;
+            if (!readFitsImage(fitWeightsPath, weights)) {
+                return false;
+            }
+            if (weights.axes != map.axes) {
+                std::cerr << fitWeightsPath << " does not match the size of " << fitSource << std::endl;
+                return false;
+            }
+            weight = weights.data;
+        }
+        FitsAxis axes[2];
+        for (int a = 0; a < 2; a++) {
+            std::string n = std::to_string(a + 1);
+            axes[a] = { map.axes[a], "", "", map.number("CRPIX" + n, 1.0), map.number("CRVAL" + n, 0.0), map.number("CDELT" + n, 1.0) };
+        }
+        addRotationPixels(map.data, weight, map.axes[0], map.axes[1], axes[0], axes[1], data);
+        data.observerVelocity = (float)map.number("OBSVEL", ctx.observerVelocity);
+    }
+    if (data.size() == 0) {
+        std::cerr << "The velocity map has no usable pixels" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// One parameter set, in the form the residual kernel uses
+struct RotationModel {
+    float keplerian; // K^2 GALAXY_RADIUS
+    float flat;      // V^2
+    float core;      // rc^2
+};
+
+// Weighted squared residuals of every model over pixels [begin, end), added to chi2.
+// The model velocity is the circular speed projected as lineOfSightVelocity() does.
+void rotationResiduals(const RotationData& data, size_t begin, size_t end, const std::vector<RotationModel>& models, double* chi2) {
+    for (size_t blockStart = begin; blockStart < end; blockStart += FIT_PIXEL_BLOCK) {
+        size_t blockEnd = std::min(blockStart + FIT_PIXEL_BLOCK, end);
+        for (size_t m = 0; m < models.size(); m++) {
+            const RotationModel& model = models[m];
+            size_t i = blockStart;
+            double sum = 0.0;
+#ifdef RDE_HAVE_SSE2
+            const __m128 keplerian = _mm_set1_ps(model.keplerian), flat = _mm_set1_ps(model.flat), core = _mm_set1_ps(model.core);
+            const __m128 softening = _mm_set1_ps(0.1f), observerZ = _mm_set1_ps(OBSERVER_POSITION_Z);
+            const __m128 observer = _mm_set1_ps(data.observerVelocity);
+            __m128 accumulator = _mm_setzero_ps();
+            for (; i + 4 <= blockEnd; i += 4) {
+                __m128 r = _mm_loadu_ps(&data.radius[i]);
+                __m128 r2 = _mm_mul_ps(r, r);
+                __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_div_ps(keplerian, _mm_add_ps(r, softening)),
+                    _mm_div_ps(_mm_mul_ps(flat, r2), _mm_add_ps(r2, core))));
+                __m128 vx = _mm_mul_ps(speed, _mm_loadu_ps(&data.tangentX[i]));
+                __m128 vz = _mm_mul_ps(speed, _mm_loadu_ps(&data.tangentZ[i]));
+                __m128 dz = _mm_sub_ps(observerZ, vz);
+                __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(dz, dz)));
+                __m128 projected = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(vz, observer), dz), _mm_mul_ps(vx, vx)), length);
+                __m128 residual = _mm_sub_ps(_mm_loadu_ps(&data.velocity[i]), projected);
+                accumulator = _mm_add_ps(accumulator, _mm_mul_ps(_mm_loadu_ps(&data.weight[i]), _mm_mul_ps(residual, residual)));
+            }
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, accumulator);
+            sum = (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+            for (; i < blockEnd; i++) {
+                float r = data.radius[i];
+                float speed = sqrtf(model.keplerian / (r + 0.1f) + model.flat * r * r / (r * r + model.core));
+                float vx = speed * data.tangentX[i], vz = speed * data.tangentZ[i];
+                float dz = OBSERVER_POSITION_Z - vz;
+                float projected = ((vz - data.observerVelocity) * dz - vx * vx) / sqrtf(vx * vx + dz * dz);
+                float residual = data.velocity[i] - projected;
+                sum += data.weight[i] * residual * residual;
+            }
+            chi2[m] += sum;
+        }
+    }
+}
+
+// Log likelihood of every parameter set, in one parallel pass over the pixels on `threads` workers
+void rotationLogLikelihoods(const RotationData& data, const std::vector<std::array<double, FIT_PARAMETERS>>& parameters,
+    std::vector<double>& logLikelihoods, unsigned int threads) {
+    size_t count = parameters.size();
+    std::vector<RotationModel> models(count);
+    for (size_t m = 0; m < count; m++) {
+        const auto& p = parameters[m];
+        models[m] = { (float)(p[0] * p[0] * GALAXY_RADIUS), (float)(p[1] * p[1]), (float)(p[2] * p[2]) };
+    }
+    unsigned int workers = workerThreadCount(threads);
+    std::vector<double> chi2(workers * count, 0.0);
+    // Ranges are split on whole SSE2 groups; the last one ends with the scalar tail
+    parallelFor(workers, (data.size() + 3) / 4, [&](size_t begin, size_t end, unsigned int worker) {
+        rotationResiduals(data, begin * 4, std::min(end * 4, data.size()), models, &chi2[worker * count]);
+    });
+    logLikelihoods.assign(count, 0.0);
+    for (size_t m = 0; m < count; m++) {
+        double sum = 0.0;
+        for (unsigned int worker = 0; worker < workers; worker++) {
+            sum += chi2[worker * count + m];
+        }
+        double lnSigma = parameters[m][3];
+        logLikelihoods[m] = -0.5 * sum * exp(-2.0 * lnSigma) - (double)data.size() * lnSigma;
+    }
+}
+
+bool insidePrior(const std::array<double, FIT_PARAMETERS>& p) {
+    for (int k = 0; k < FIT_PARAMETERS; k++) {
+        if (!(p[k] >= FIT_PRIOR_MIN[k] && p[k] <= FIT_PRIOR_MAX[k])) return false;
+    }
+    return true;
+}
+
+// Likelihood evaluations per second at 1, 2, 4, ... worker threads
+void reportFitScaling(const RotationData& data, size_t batch, unsigned int maxThreads) {
+    std::vector<std::array<double, FIT_PARAMETERS>> parameters(batch, std::array<double, FIT_PARAMETERS>{ 0.3, 0.3, 1.0, -3.0 });
+    std::vector<double> logLikelihoods;
+    double singleRate = 0.0;
+    for (unsigned int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        int rounds = 0;
+        auto start = std::chrono::steady_clock::now();
+        double seconds = 0.0;
+        while (seconds < 0.5) {
+            rotationLogLikelihoods(data, parameters, logLikelihoods, threads);
+            rounds++;
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        double rate = rounds * batch / seconds;
+        if (threads == 1) singleRate = rate;
+        std::cout << "  " << threads << " threads: " << rate << " evaluations/s (speedup " << rate / singleRate << ")" << std::endl;
+        if (threads == maxThreads) break;
+    }
+}
+
+bool runRotationFit(const SimulationContext& ctx) {
+    RotationData data;
+    if (!loadRotationData(ctx, data)) {
+        return false;
+    }
+
+    int temperatures = std::max(fitTemperatures, 1);
+    std::vector<double> beta(temperatures);
+    for (int t = 0; t < temperatures; t++) {
+        beta[t] = temperatures > 1 ? pow(fitMaxTemperature, -(double)t / (temperatures - 1)) : 1.0;
+    }
+
+    std::mt19937 random(ctx.seed);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<std::array<double, FIT_PARAMETERS>> state(temperatures, std::array<double, FIT_PARAMETERS>{ 0.3, 0.3, 2.0, -3.0 });
+    std::vector<std::array<double, FIT_PARAMETERS>> step(temperatures);
+    for (int t = 0; t < temperatures; t++) {
+        double scale = sqrt(1.0 / beta[t]);
+        step[t] = { 0.01 * scale, 0.01 * scale, 0.1 * scale, 0.05 * scale };
+    }
+    std::vector<double> logLikelihood;
+    rotationLogLikelihoods(data, state, logLikelihood, ctx.threads);
+
+    int burnIn = fitIterations / 2;
+    std::vector<int> accepted(temperatures, 0), swapsAccepted(temperatures, 0), swapsTried(temperatures, 0);
+    std::vector<std::array<double, FIT_PARAMETERS>> samples;
+    std::vector<std::array<double, FIT_PARAMETERS>> proposal(temperatures);
+    std::vector<double> proposalLogLikelihood;
+    uint64_t evaluations = 0;
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (int iteration = 0; iteration < fitIterations; iteration++) {
+        for (int t = 0; t < temperatures; t++) {
+            for (int k = 0; k < FIT_PARAMETERS; k++) {
+                proposal[t][k] = state[t][k] + step[t][k] * normal(random);
+            }
+        }
+        rotationLogLikelihoods(data, proposal, proposalLogLikelihood, ctx.threads);
+        evaluations += temperatures;
+
+        for (int t = 0; t < temperatures; t++) {
+            if (insidePrior(proposal[t]) && log(uniform(random)) < beta[t] * (proposalLogLikelihood[t] - logLikelihood[t])) {
+                state[t] = proposal[t];
+                logLikelihood[t] = proposalLogLikelihood[t];
+                accepted[t]++;
+            }
+        }
+
+        // Swap neighbouring temperatures, alternating even and odd pairs
+        for (int t = iteration % 2; t + 1 < temperatures; t += 2) {
+            swapsTried[t]++;
+            if (log(uniform(random)) < (beta[t] - beta[t + 1]) * (logLikelihood[t + 1] - logLikelihood[t])) {
+                std::swap(state[t], state[t + 1]);
+                std::swap(logLikelihood[t], logLikelihood[t + 1]);
+                swapsAccepted[t]++;
+            }
+        }
+
+        // Tune each chain's step towards a quarter of proposals accepted during burn-in
+        if (iteration < burnIn && (iteration + 1) % 100 == 0) {
+            for (int t = 0; t < temperatures; t++) {
+                double rate = accepted[t] / 100.0;
+                double factor = rate > 0.35 ? 1.5 : rate < 0.15 ? 0.6 : 1.0;
+                for (int k = 0; k < FIT_PARAMETERS; k++) step[t][k] *= factor;
+                accepted[t] = 0;
+            }
+        }
+        // Count acceptances from the first sampled iteration on
+        if (iteration + 1 == burnIn) {
+            std::fill(accepted.begin(), accepted.end(), 0);
+        }
+        if (iteration >= burnIn) {
+            samples.push_back(state[0]);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout << "Fitted " << data.size() << " map pixels with " << temperatures << " temperatures x "
+        << fitIterations << " iterations: " << evaluations / seconds << " likelihood evaluations/s on "
+        << workerThreadCount(ctx.threads) << " threads" << std::endl;
+    std::cout << "Cold chain acceptance " << (double)accepted[0] / std::max<size_t>(samples.size(), 1);
+    if (temperatures > 1) std::cout << ", lowest swap acceptance " << (double)swapsAccepted[0] / std::max(swapsTried[0], 1);
+    std::cout << std::endl;
+
+    for (int k = 0; k < FIT_PARAMETERS; k++) {
+        std::vector<double> values;
+        for (const auto& sample : samples) values.push_back(sample[k]);
+        std::sort(values.begin(), values.end());
+        auto quantile = [&](double q) { return values.empty() ? 0.0 : values[(size_t)(q * (values.size() - 1))]; };
+        std::cout << "  " << FIT_PARAMETER_NAMES[k] << " = " << quantile(0.5) << " (16%: " << quantile(0.16)
+            << ", 84%: " << quantile(0.84) << ")" << std::endl;
+    }
+
+    if (!fitChainPath.empty()) {
+        FILE* file = fopen(fitChainPath.c_str(), "w");
+        if (!file) {
+            std::cerr << "Cannot create " << fitChainPath << std::endl;
+            return false;
+        }
+        fprintf(file, "K,V,rc,ln_sigma\n");
+        for (const auto& sample : samples) {
+            fprintf(file, "%.9g,%.9g,%.9g,%.9g\n", sample[0], sample[1], sample[2], sample[3]);
+        }
+        if (fclose(file) != 0) {
+            std::cerr << "Cannot write " << fitChainPath << std::endl;
+            return false;
+        }
+    }
+
+    if (fitScaling) {
+        std::cout << "Likelihood scaling, " << temperatures << " models per pass:" << std::endl;
+        reportFitScaling(data, temperatures, workerThreadCount(ctx.threads));
+    }
+    return true;
+}
+
+// Fast Fourier transform
+// In-place iterative radix-2 transform of a power-of-two length. A plan holds
+// the bit-reversal permutation and twiddle factors, so every transform of one
+// size shares them; the inverse transform is not normalized.
+struct FftPlan {
+    size_t size;
+    std::vector<uint32_t> reversed;
+    std::vector<std::complex<float>> twiddles; // exp(-2 pi i k / size) for k < size / 2
+
+    FftPlan(size_t n) : size(n), reversed(n), twiddles(n / 2) {
+        int bits = 0;
+        while (((size_t)1 << bits) < n) bits++;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t r = 0;
+            for (int b = 0; b < bits; b++) {
+                if (i & ((size_t)1 << b)) r |= 1u << (bits - 1 - b);
+            }
+            reversed[i] = r;
+        }
+        for (size_t k = 0; k < n / 2; k++) {
+            double angle = -2.0 * M_PI * k / n;
+            twiddles[k] = std::complex<float>((float)cos(angle), (float)sin(angle));
+        }
+    }
+
+    void transform(std::complex<float>* data, bool inverse) const {
+        for (size_t i = 0; i < size; i++) {
+            if (i < reversed[i]) std::swap(data[i], data[reversed[i]]);
+        }
+        for (size_t length = 2; length <= size; length *= 2) {
+            size_t half = length / 2;
+            size_t stride = size / length;
+            for (size_t start = 0; start < size; start += length) {
+                for (size_t j = 0; j < half; j++) {
+                    std::complex<float> w = inverse ? std::conj(twiddles[j * stride]) : twiddles[j * stride];
+                    std::complex<float> u = data[start + j];
+                    std::complex<float> v = data[start + j + half] * w;
+                    data[start + j] = u + v;
+                    data[start + j + half] = u - v;
+                }
+            }
+        }
+    }
+};
+
+// Redshift measurement
+// Measures Doppler factors back out of synthetic spectra. Each sampled star's
+// spectrum (its line list, Doppler shifted, plus Gaussian noise) and a rest-frame
+// template are drawn on a grid uniform in ln(wavelength), where a Doppler factor
+// D is a shift by ln D. The spectrum is cross-correlated with the template by
+// FFT (zero padded to twice the grid, so the correlation does not wrap), the
+// peak lag is refined with a parabola through its neighbours, and the result is
+// compared with calculateRelativisticDopplerShift(). The template is real, so
+// two spectra packed as the real and imaginary parts of one transform come out
+// of the inverse transform as the real and imaginary parts of their two
+// correlations. Pairs of spectra are processed in parallel, each worker with its
+// own buffers, sharing one FFT plan and the transformed template.
+int redshiftSpectra = 0; // per model; 0 = off
+int redshiftPixels = 4096;
+float redshiftNoise = 0.02f; // per pixel, relative to the peak of a unit-strength line
+std::string redshiftOutputPath;
+
+struct LogWavelengthGrid {
+    int pixels;
+    double lnStart;
+    double lnIncrement;
+
+    LogWavelengthGrid() : pixels(redshiftPixels), lnStart(log((double)cubeWavelengthMin)),
+        lnIncrement((log((double)cubeWavelengthMax) - log((double)cubeWavelengthMin)) / redshiftPixels) {}
+
+    // Add every line, shifted by dopplerFactor, as a Gaussian peaking at its strength
+    void drawLines(const std::vector<SpectralLine>& lines, double dopplerFactor, float* spectrum) const {
+        for (const auto& line : lines) {
+            double centre = (log(line.rest * dopplerFactor) - lnStart) / lnIncrement;
+            double sigma = std::max(cubeLineWidth / line.rest / lnIncrement, 0.5);
+            double reach = CUBE_PROFILE_SIGMAS * sigma;
+            int low = std::max((int)ceil(centre - reach), 0);
+            int high = std::min((int)floor(centre + reach), pixels - 1);
+            for (int p = low; p <= high; p++) {
+                double offset = (p - centre) / sigma;
+                spectrum[p] += (float)(line.strength * exp(-0.5 * offset * offset));
+            }
+        }
+    }
+};
+
+struct RedshiftResult {
+    uint32_t star;
+    float trueFactor;
+    float measuredFactor;
+};
+
+// Lag of the peak of the real (part 0) or imaginary (part 1) correlation in grid
+// pixels, refined to a fraction of a pixel
+double correlationPeak(const std::complex<float>* correlation, size_t size, int part) {
+    const float* values = reinterpret_cast<const float*>(correlation) + part; // std::complex is two floats
+    size_t best = 0;
+    for (size_t k = 1; k < size; k++) {
+        if (values[k * 2] > values[best * 2]) best = k;
+    }
+    float left = values[((best + size - 1) % size) * 2];
+    float centre = values[best * 2];
+    float right = values[((best + 1) % size) * 2];
+    double curvature = left - 2.0 * centre + right;
+    double offset = curvature < 0.0 ? 0.5 * (left - right) / curvature : 0.0;
+    double lag = (double)best + offset;
+    return lag >= size / 2.0 ? lag - size : lag;
+}
+
+bool measureRedshifts(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+    LogWavelengthGrid grid;
+    size_t fftSize = 1;
+    while (fftSize < (size_t)grid.pixels * 2) fftSize *= 2;
+    FftPlan plan(fftSize);
+    std::vector<SpectralLine> lines = activeSpectralLines();
+
+    std::vector<std::complex<float>> templateTransform(fftSize);
+    {
+        std::vector<float> restFrame(grid.pixels, 0.0f);
+        grid.drawLines(lines, 1.0, restFrame.data());
+        for (int p = 0; p < grid.pixels; p++) templateTransform[p] = restFrame[p];
+        plan.transform(templateTransform.data(), false);
+    }
+
+    glm::vec3 observerVel(0.0f, 0.0f, ctx.observerVelocity);
+    unsigned int workers = workerThreadCount(ctx.threads);
+    std::vector<RedshiftResult> results[MODEL_COUNT];
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        const std::vector<Star>& stars = starsForModel(ctx, model);
+        size_t count = std::min<size_t>(redshiftSpectra, stars.size());
+        results[model].resize(count);
+        size_t pairs = (count + 1) / 2;
+        parallelFor(ctx.threads, pairs, [&](size_t begin, size_t end, unsigned int) {
+            std::vector<float> spectrum[2] = { std::vector<float>(grid.pixels), std::vector<float>(grid.pixels) };
+            std::vector<std::complex<float>> buffer(fftSize);
+            for (size_t pair = begin; pair < end; pair++) {
+                std::fill(buffer.begin(), buffer.end(), std::complex<float>());
+                for (int part = 0; part < 2; part++) {
+                    size_t s = pair * 2 + part;
+                    std::fill(spectrum[part].begin(), spectrum[part].end(), 0.0f);
+                    if (s >= count) continue;
+                    size_t star = s * stars.size() / count; // evenly spaced through the catalog
+                    float trueFactor = calculateRelativisticDopplerShift(stars[star].velocity, observerVel);
+                    results[model][s] = { (uint32_t)star, trueFactor, 0.0f };
+
+                    // Noise is seeded per spectrum, so results do not depend on the thread count
+                    std::mt19937 noiseGenerator(ctx.seed ^ (unsigned int)(star * 2654435761u) ^ (unsigned int)model);
+                    std::normal_distribution<float> noise(0.0f, redshiftNoise);
+                    for (int p = 0; redshiftNoise > 0.0f && p < grid.pixels; p++) spectrum[part][p] = noise(noiseGenerator);
+                    grid.drawLines(lines, trueFactor, spectrum[part].data());
+                }
+                for (int p = 0; p < grid.pixels; p++) buffer[p] = std::complex<float>(spectrum[0][p], spectrum[1][p]);
+
+                plan.transform(buffer.data(), false);
+                for (size_t k = 0; k < fftSize; k++) buffer[k] *= std::conj(templateTransform[k]);
+                plan.transform(buffer.data(), true);
+
+                for (int part = 0; part < 2 && pair * 2 + part < count; part++) {
+                    double lag = correlationPeak(buffer.data(), fftSize, part);
+                    results[model][pair * 2 + part].measuredFactor = (float)exp(lag * grid.lnIncrement);
+                }
+            }
+        });
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    size_t total = 0;
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        // Errors in ln D are velocity-like; a miss is an error above 1%
+        std::vector<double> errors;
+        size_t misses = 0;
+        for (const auto& result : results[model]) {
+            double error = log((double)result.measuredFactor / result.trueFactor);
+            if (fabs(error) > 0.01) misses++;
+            else errors.push_back(error);
+        }
+        double sum = 0.0, square = 0.0;
+        for (double error : errors) {
+            sum += error;
+            square += error * error;
+        }
+        size_t n = std::max<size_t>(errors.size(), 1);
+        std::cout << (model == MODEL_KEPLERIAN ? "Keplerian" : "Flat rotation") << ": " << results[model].size()
+            << " spectra, ln D error mean " << sum / n << " rms " << sqrt(square / n) << ", "
+            << misses << " misses (error above 1%, e.g. lines shifted off the grid)" << std::endl;
+        total += results[model].size();
+    }
+    std::cout << "Measured " << total << " redshifts (" << grid.pixels << " ln-wavelength pixels, "
+        << fftSize << "-point FFTs) in " << seconds << " s (" << total / seconds << " spectra/s on "
+        << workers << " threads)" << std::endl;
+
+    if (!redshiftOutputPath.empty()) {
+        FILE* file = fopen(redshiftOutputPath.c_str(), "w");
+        if (!file) {
+            std::cerr << "Cannot create " << redshiftOutputPath << std::endl;
+            return false;
+        }
+        fprintf(file, "star,model,true_doppler_factor,measured_doppler_factor\n");
+        for (int model = 0; model < MODEL_COUNT; model++) {
+            for (const auto& result : results[model]) {
+                fprintf(file, "%u,%s,%.9g,%.9g\n", result.star, model == MODEL_KEPLERIAN ? "keplerian" : "flat",
+                    result.trueFactor, result.measuredFactor);
+            }
+        }
+        if (fclose(file) != 0) {
+            std::cerr << "Cannot write " << redshiftOutputPath << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Ensemble statistics
+// Generates ensembleRealizations independent catalogs, realization r from seed
+// --seed + r, and reduces each to its own statistics: a histogram of
+// ln(Doppler factor), the mean factor, the redshifted fraction and the fraction
+// of stars whose Doppler-shifted colour is dominated by red, green or blue.
+// Realizations are spread over the workers, each generating into its own
+// catalogs, and every realization's statistics go to its own slot. The ensemble
+// mean and scatter are then summed in realization order, so the results are
+// identical for any number of threads.
+const int ENSEMBLE_BINS = 60;
+const float ENSEMBLE_LN_RANGE = 3.0f; // histogram covers ln D in [-3, 3]; outliers go to the end bins
+
+int ensembleRealizations = 0;
+std::string ensembleOutputPath;
+
+enum EnsembleStatistic {
+    ENSEMBLE_MEAN_FACTOR,
+    ENSEMBLE_REDSHIFTED,
+    ENSEMBLE_RED,
+    ENSEMBLE_GREEN,
+    ENSEMBLE_BLUE,
+    ENSEMBLE_HISTOGRAM, // first of ENSEMBLE_BINS
+    ENSEMBLE_STATISTICS = ENSEMBLE_HISTOGRAM + ENSEMBLE_BINS
+};
+
+// Statistics of one model of one realization, as fractions of its stars
+void realizationStatistics(const std::vector<Star>& stars, const glm::vec3& observerVel, double* statistics) {
+    std::fill(statistics, statistics + ENSEMBLE_STATISTICS, 0.0);
+    for (const auto& star : stars) {
+        float rgb[3];
+        float dopplerFactor = dopplerShiftedStarColor(star.velocity, observerVel, rgb);
+        statistics[ENSEMBLE_MEAN_FACTOR] += dopplerFactor;
+        statistics[ENSEMBLE_REDSHIFTED] += dopplerFactor > 1.0f ? 1.0 : 0.0;
+        int dominant = rgb[0] >= rgb[1] && rgb[0] >= rgb[2] ? 0 : rgb[1] >= rgb[2] ? 1 : 2;
+        statistics[ENSEMBLE_RED + dominant] += 1.0;
+        int bin = (int)floorf((logf(dopplerFactor) + ENSEMBLE_LN_RANGE) / (2.0f * ENSEMBLE_LN_RANGE) * ENSEMBLE_BINS);
+        statistics[ENSEMBLE_HISTOGRAM + glm::clamp(bin, 0, ENSEMBLE_BINS - 1)] += 1.0;
+    }
+    for (int s = 0; s < ENSEMBLE_STATISTICS; s++) {
+        statistics[s] /= std::max<size_t>(stars.size(), 1);
+    }
+}
+
+std::string ensembleStatisticName(int statistic) {
+    static const char* names[] = { "mean_doppler_factor", "redshifted_fraction", "red_fraction", "green_fraction", "blue_fraction" };
+    if (statistic < ENSEMBLE_HISTOGRAM) return names[statistic];
+    int bin = statistic - ENSEMBLE_HISTOGRAM;
+    char name[64];
+    snprintf(name, sizeof(name), "ln_doppler_factor[%.2f:%.2f)", -ENSEMBLE_LN_RANGE + bin * 2.0f * ENSEMBLE_LN_RANGE / ENSEMBLE_BINS,
+        -ENSEMBLE_LN_RANGE + (bin + 1) * 2.0f * ENSEMBLE_LN_RANGE / ENSEMBLE_BINS);
+    return name;
+}
+
+bool runEnsemble(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+    size_t realizations = (size_t)ensembleRealizations;
+    glm::vec3 observerVel(0.0f, 0.0f, ctx.observerVelocity);
+    std::vector<double> statistics(realizations * MODEL_COUNT * ENSEMBLE_STATISTICS);
+
+    // Each worker owns one context and regenerates it for every realization in its range
+    parallelFor(ctx.threads, realizations, [&](size_t begin, size_t end, unsigned int) {
+        SimulationContext realization;
+        realization.observerVelocity = ctx.observerVelocity;
+        for (size_t r = begin; r < end; r++) {
+            initializeStars(realization, ctx.seed + (unsigned int)r);
+            realizationStatistics(realization.keplerianStars, observerVel,
+                &statistics[(r * MODEL_COUNT + MODEL_KEPLERIAN) * ENSEMBLE_STATISTICS]);
+            realizationStatistics(realization.flatRotationStars, observerVel,
+                &statistics[(r * MODEL_COUNT + MODEL_FLAT_ROTATION) * ENSEMBLE_STATISTICS]);
+        }
+    });
+
+    // Mean and sample standard deviation over realizations, always summed in realization order
+    std::vector<double> mean(MODEL_COUNT * ENSEMBLE_STATISTICS, 0.0), deviation(MODEL_COUNT * ENSEMBLE_STATISTICS, 0.0);
+    for (size_t r = 0; r < realizations; r++) {
+        for (int s = 0; s < MODEL_COUNT * ENSEMBLE_STATISTICS; s++) {
+            mean[s] += statistics[r * MODEL_COUNT * ENSEMBLE_STATISTICS + s];
+        }
+    }
+    for (double& value : mean) value /= realizations;
+    for (size_t r = 0; r < realizations; r++) {
+        for (int s = 0; s < MODEL_COUNT * ENSEMBLE_STATISTICS; s++) {
+            double difference = statistics[r * MODEL_COUNT * ENSEMBLE_STATISTICS + s] - mean[s];
+            deviation[s] += difference * difference;
+        }
+    }
+    for (double& value : deviation) value = realizations > 1 ? sqrt(value / (realizations - 1)) : 0.0;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        const double* m = &mean[model * ENSEMBLE_STATISTICS];
+        const double* d = &deviation[model * ENSEMBLE_STATISTICS];
+        std::cout << (model == MODEL_KEPLERIAN ? "Keplerian" : "Flat rotation") << ": mean Doppler factor "
+            << m[ENSEMBLE_MEAN_FACTOR] << " +/- " << d[ENSEMBLE_MEAN_FACTOR] << ", redshifted "
+            << m[ENSEMBLE_REDSHIFTED] << " +/- " << d[ENSEMBLE_REDSHIFTED] << ", red/green/blue "
+            << m[ENSEMBLE_RED] << "/" << m[ENSEMBLE_GREEN] << "/" << m[ENSEMBLE_BLUE] << std::endl;
+    }
+    std::cout << "Evaluated " << realizations << " realizations of " << NUM_STARS << " stars (seeds " << ctx.seed
+        << " to " << ctx.seed + realizations - 1 << ") in " << seconds << " s" << std::endl;
+
+    if (!ensembleOutputPath.empty()) {
+        FILE* file = fopen(ensembleOutputPath.c_str(), "w");
+        if (!file) {
+            std::cerr << "Cannot create " << ensembleOutputPath << std::endl;
+            return false;
+        }
+        fprintf(file, "model,statistic,mean,stddev\n");
+        for (int model = 0; model < MODEL_COUNT; model++) {
+            for (int s = 0; s < ENSEMBLE_STATISTICS; s++) {
+                fprintf(file, "%s,%s,%.9g,%.9g\n", model == MODEL_KEPLERIAN ? "keplerian" : "flat", ensembleStatisticName(s).c_str(),
+                    mean[model * ENSEMBLE_STATISTICS + s], deviation[model * ENSEMBLE_STATISTICS + s]);
+            }
+        }
+        if (fclose(file) != 0) {
+            std::cerr << "Cannot write " << ensembleOutputPath << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Mock Tully-Fisher catalogs
+// Generates tullyFisherGalaxies galaxies, galaxy g from seed --seed + g,
+// with a log-uniform mass between 10^TF_LOG_MASS_MIN and 1 (in units of the
+// default galaxy), an isotropic inclination and a randomly chosen rotation
+// model. Disks keep a constant surface density, so radius and star count grow
+// as mass^1/2 and the flat rotation speed as mass^1/4. Each galaxy is measured
+// like an unresolved survey target: the widths at 50% and 20% of the peak of
+// its integrated line profile, deprojected by its inclination.
+// Galaxies are streamed: stars are generated a DOPPLER_BLOCK_STARS block at a
+// time into a per-worker buffer, passed through the batched Doppler kernel and
+// added to the worker's profile histogram, so no star data outlives its block.
+// Galaxy costs span three orders of magnitude, so they are spread over the
+// workers with workStealingFor() rather than fixed ranges.
+const float TF_LOG_MASS_MIN = -3.0f;
+const size_t TF_MIN_STARS = 1000;
+const int TF_PROFILE_BINS = 1000; // radial velocity in [-c, c]
+
+int tullyFisherGalaxies = 0;
+size_t tullyFisherStars = 20000; // stars of a galaxy of mass 1
+std::string tullyFisherOutputPath = "tully_fisher.csv";
+
+struct MockGalaxy {
+    int model;
+    float logMass;
+    float inclination; // radians, 0 = face-on
+    size_t starCount;
+    float w50;         // line widths as radial velocity [c]
+    float w20;
+};
+
+MockGalaxy drawMockGalaxy(std::mt19937& generator) {
+    std::uniform_real_distribution<float> logMass(TF_LOG_MASS_MIN, 0.0f);
+    std::uniform_real_distribution<float> cosInclination(0.0f, 1.0f);
+    std::bernoulli_distribution flat(0.5);
+    MockGalaxy galaxy = {};
+    galaxy.logMass = logMass(generator);
+    galaxy.inclination = acosf(cosInclination(generator));
+    galaxy.model = flat(generator) ? MODEL_FLAT_ROTATION : MODEL_KEPLERIAN;
+    galaxy.starCount = std::max(TF_MIN_STARS, (size_t)(tullyFisherStars * powf(10.0f, 0.5f * galaxy.logMass)));
+    return galaxy;
+}
+
+// A star of the galaxy, with the disk tilted about the x axis to the galaxy's inclination
+Star mockGalaxyStar(const MockGalaxy& galaxy, std::mt19937& generator, std::uniform_real_distribution<float>& angles,
+    std::uniform_real_distribution<float>& radii, std::uniform_real_distribution<float>& heights) {
+    float mass = powf(10.0f, galaxy.logMass);
+    float angle = angles(generator);
+    float radius = radii(generator);
+    float height = heights(generator);
+    float speed = galaxy.model == MODEL_KEPLERIAN ? MAX_VELOCITY * sqrtf(mass * GALAXY_RADIUS / (radius + 0.1f))
+        : FLAT_ROTATION_VELOCITY * powf(mass, 0.25f);
+    float sinI = sinf(galaxy.inclination), cosI = cosf(galaxy.inclination);
+    float x = radius * cosf(angle), z = radius * sinf(angle);
+    float vx = -speed * sinf(angle), vz = speed * cosf(angle);
+
+    Star star = {};
+    star.position = glm::vec3(x, height * sinI - z * cosI, height * cosI + z * sinI);
+    star.velocity = glm::vec3(vx, -vz * cosI, vz * sinI);
+    return star;
+}
+
+// Width of a profile between its outermost crossings of fraction * peak, interpolated within bins
+float profileWidth(const std::vector<double>& profile, double fraction, float binWidth) {
+    double peak = *std::max_element(profile.begin(), profile.end());
+    if (!(peak > 0.0)) return 0.0f;
+    double threshold = fraction * peak;
+    int bins = (int)profile.size();
+    int low = 0, high = bins - 1;
+    while (profile[low] < threshold) low++;
+    while (profile[high] < threshold) high--;
+    double lowEdge = low, highEdge = high;
+    if (low > 0) lowEdge -= (profile[low] - threshold) / (profile[low] - profile[low - 1]);
+    if (high < bins - 1) highEdge += (profile[high] - threshold) / (profile[high] - profile[high + 1]);
+    return (float)((highEdge - lowEdge) * binWidth);
+}
+
+// Measure one galaxy, generating its stars block by block into a worker's buffer
+void measureMockGalaxy(MockGalaxy& galaxy, std::mt19937& generator, const std::vector<glm::vec3>& observers,
+    std::vector<Star>& block, std::vector<double>& profile) {
+    std::uniform_real_distribution<float> angles = angleDistribution;
+    std::uniform_real_distribution<float> radii(0.1f, GALAXY_RADIUS * powf(10.0f, 0.5f * galaxy.logMass));
+    std::uniform_real_distribution<float> heights = heightDistribution;
+    const float binWidth = 2.0f * SPEED_OF_LIGHT / TF_PROFILE_BINS;
+    std::fill(profile.begin(), profile.end(), 0.0);
+
+    for (size_t first = 0; first < galaxy.starCount; first += DOPPLER_BLOCK_STARS) {
+        block.resize(std::min(DOPPLER_BLOCK_STARS, galaxy.starCount - first));
+        for (auto& star : block) {
+            star = mockGalaxyStar(galaxy, generator, angles, radii, heights);
+        }
+        dopplerFactorsForObservers(block, 0, block.size(), observers, [&](size_t, size_t, const float* factors, size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                float squared = factors[i] * factors[i];
+                float velocity = SPEED_OF_LIGHT * (squared - 1.0f) / (squared + 1.0f);
+                int bin = (int)floorf((velocity + SPEED_OF_LIGHT) / binWidth);
+                profile[glm::clamp(bin, 0, TF_PROFILE_BINS - 1)] += 1.0;
+            }
+        });
+    }
+    galaxy.w50 = profileWidth(profile, 0.5, binWidth);
+    galaxy.w20 = profileWidth(profile, 0.2, binWidth);
+}
+
+bool runTullyFisher(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+    size_t galaxyCount = (size_t)tullyFisherGalaxies;
+    std::vector<glm::vec3> observers = observerStates(std::vector<float>(1, ctx.observerVelocity));
+    std::vector<MockGalaxy> galaxies(galaxyCount);
+
+    unsigned int workers = workerThreadCount(ctx.threads);
+    std::vector<std::vector<Star>> blocks(workers);
+    std::vector<std::vector<double>> profiles(workers, std::vector<double>(TF_PROFILE_BINS));
+    std::vector<uint64_t> workerStars(workers, 0);
+    size_t steals = workStealingFor(ctx.threads, galaxyCount, [&](size_t g, unsigned int worker) {
+        std::mt19937 generator(ctx.seed + (unsigned int)g);
+        galaxies[g] = drawMockGalaxy(generator);
+        measureMockGalaxy(galaxies[g], generator, observers, blocks[worker], profiles[worker]);
+        workerStars[worker] += galaxies[g].starCount;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    FILE* file = fopen(tullyFisherOutputPath.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot create " << tullyFisherOutputPath << std::endl;
+        return false;
+    }
+    fprintf(file, "galaxy,model,log_mass,inclination_deg,stars,w50,w20,rotation_velocity\n");
+    uint64_t totalStars = 0;
+    for (size_t g = 0; g < galaxyCount; g++) {
+        const MockGalaxy& galaxy = galaxies[g];
+        float sinI = sinf(galaxy.inclination);
+        fprintf(file, "%zu,%s,%.6f,%.4f,%zu,%.7g,%.7g,%.7g\n", g, galaxy.model == MODEL_KEPLERIAN ? "keplerian" : "flat",
+            galaxy.logMass, galaxy.inclination * 180.0 / M_PI, galaxy.starCount, galaxy.w50, galaxy.w20,
+            sinI > 0.0f ? 0.5f * galaxy.w50 / sinI : 0.0f);
+        totalStars += galaxy.starCount;
+    }
+    if (fclose(file) != 0) {
+        std::cerr << "Cannot write " << tullyFisherOutputPath << std::endl;
+        return false;
+    }
+
+    // Least-squares slope of log mass against log rotation velocity, skipping nearly face-on galaxies
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        double n = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+        for (const MockGalaxy& galaxy : galaxies) {
+            float sinI = sinf(galaxy.inclination);
+            if (galaxy.model != model || sinI < 0.5f || !(galaxy.w50 > 0.0f)) continue;
+            double x = log10(0.5 * galaxy.w50 / sinI), y = galaxy.logMass;
+            n += 1.0;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        double denominator = n * sxx - sx * sx;
+        if (n >= 2.0 && denominator > 0.0) {
+            std::cout << (model == MODEL_KEPLERIAN ? "Keplerian" : "Flat rotation") << " Tully-Fisher slope: log M = "
+                << (n * sxy - sx * sy) / denominator << " log V + const over " << n << " galaxies" << std::endl;
+        }
+    }
+    uint64_t busiest = *std::max_element(workerStars.begin(), workerStars.end());
+    std::cout << "Measured " << galaxyCount << " galaxies (" << totalStars << " stars) in " << seconds << " s ("
+        << totalStars / seconds / 1e6 << " M stars/s, " << steals << " galaxies stolen, busiest worker "
+        << (totalStars ? 100.0 * busiest * workers / totalStars : 100.0) << "% of mean load), wrote "
+        << tullyFisherOutputPath << std::endl;
+    return true;
+}
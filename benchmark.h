@@ -0,0 +1,460 @@
+#pragma once
+// Benchmarks: hardware counters, microbenchmarks and the scaling and roofline report
+
+// Hardware performance counters
+// PerfCounters opens cycles, instructions, cache misses and branch
+// mispredictions for the calling thread through perf_event_open. Counters are
+// inherited by threads created afterwards, and a thread's counts are added to
+// its creator's when it exits, so regions that join their workers (as
+// parallelFor() does) are counted in full. Counts are scaled for the time the
+// kernel multiplexed a counter out. A counter the kernel or CPU refuses reads
+// NaN; elsewhere than Linux all of them do.
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+const char* const PERF_COUNTER_NAMES[PERF_COUNTER_COUNT] = { "hw_cycles", "instructions", "cache_misses", "branch_misses" };
+
+class PerfCounters {
+public:
+    PerfCounters() {}
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters() { close(); }
+
+    // True when at least one counter could be opened
+    bool open() {
+        close();
+#ifdef RDE_HAVE_PERF_EVENTS
+        static const uint64_t events[PERF_COUNTER_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = events[c];
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds[c] >= 0) opened = true;
+        }
+#endif
+        return opened;
+    }
+
+    bool available() const { return opened; }
+
+    // Counts since open()
+    void read(double values[PERF_COUNTER_COUNT]) const {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            values[c] = std::numeric_limits<double>::quiet_NaN();
+#ifdef RDE_HAVE_PERF_EVENTS
+            uint64_t data[3]; // value, time enabled, time running
+            if (fds[c] < 0 || ::read(fds[c], data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0) continue;
+            values[c] = (double)data[0] * ((double)data[1] / (double)data[2]);
+#endif
+        }
+    }
+
+    void close() {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+#ifdef RDE_HAVE_PERF_EVENTS
+            if (fds[c] >= 0) ::close(fds[c]);
+#endif
+            fds[c] = -1;
+        }
+        opened = false;
+    }
+
+private:
+    int fds[PERF_COUNTER_COUNT] = { -1, -1, -1, -1 };
+    bool opened = false;
+};
+
+// Microbenchmarks
+// --bench FILE times the core per-star kernels in every variant the tree has
+// (scalar, SSE2 and threaded) for star counts from benchMinStars to
+// benchMaxStars in decades, and writes the results as JSON for tracking over
+// time. The default range stops at 1e7 stars: 1e8 needs about 10 GB for the
+// two star arrays alone, so it is only run when asked for with --bench-stars.
+// The "sse2 batched" rows time the batched multi-observer kernel with a single
+// observer, which is where the tree's SIMD Doppler code lives. Each measurement is repeated for at least benchMinSeconds and the
+// fastest run is kept. Bytes per star count the nominal memory traffic of a
+// kernel (inputs read plus outputs written); cycles come from the time stamp
+// counter where there is one, and from PerfCounters, per star, where the
+// kernel allows it. Stars are per model; kernels that process both models
+// report rates over the stars of both.
+std::string benchPath;
+size_t benchMinStars = 1000;
+size_t benchMaxStars = 10000000;
+double benchMinSeconds = 0.25;
+
+struct BenchResult {
+    std::string kernel;
+    std::string variant;
+    size_t stars;
+    double seconds;      // fastest run
+    double starsPerSecond;
+    double bytesPerStar;
+    double cyclesPerStar;
+    double countersPerStar[PERF_COUNTER_COUNT]; // NaN when unavailable
+};
+
+uint64_t readCycleCounter() {
+#ifdef RDE_HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Time fn() and record the fastest of repeated runs
+template <typename Function>
+BenchResult timeKernel(const PerfCounters& counters, const char* kernel, const char* variant, size_t stars, size_t starsProcessed,
+    double bytesPerStar, Function fn) {
+    BenchResult result = { kernel, variant, stars, std::numeric_limits<double>::max(), 0.0, bytesPerStar, 0.0, {} };
+    double total = 0.0;
+    for (int run = 0; run == 0 || (total < benchMinSeconds && run < 1000); run++) {
+        double before[PERF_COUNTER_COUNT], after[PERF_COUNTER_COUNT];
+        counters.read(before);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startCycles = readCycleCounter();
+        fn();
+        uint64_t cycles = readCycleCounter() - startCycles;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        counters.read(after);
+        total += seconds;
+        if (seconds < result.seconds) {
+            result.seconds = seconds;
+            result.cyclesPerStar = (double)cycles / starsProcessed;
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+                result.countersPerStar[c] = (after[c] - before[c]) / starsProcessed;
+            }
+        }
+    }
+    result.starsPerSecond = starsProcessed / std::max(result.seconds, 1e-12);
+    printf("%-20s %-16s %10zu %12.2f M stars/s %6.0f B/star %8.2f cycles/star", kernel, variant, stars, result.starsPerSecond / 1e6,
+        bytesPerStar, result.cyclesPerStar);
+    const double* perStar = result.countersPerStar;
+    if (counters.available()) {
+        printf(" | IPC %5.2f %8.4f cache misses/star %8.4f branch misses/star", perStar[PERF_INSTRUCTIONS] / perStar[PERF_CYCLES],
+            perStar[PERF_CACHE_MISSES], perStar[PERF_BRANCH_MISSES]);
+    }
+    printf("\n");
+    fflush(stdout);
+    return result;
+}
+
+bool runBenchmarks(const SimulationContext& settings) {
+    std::vector<BenchResult> results;
+    glm::vec3 observerVel(0.0f, 0.0f, settings.observerVelocity);
+    std::vector<glm::vec3> observers = observerStates(std::vector<float>(1, settings.observerVelocity));
+    unsigned int workers = workerThreadCount();
+    PerfCounters counters;
+    std::cout << "Benchmarking on " << workers << " threads, hardware counters "
+        << (counters.open() ? "available" : "unavailable") << std::endl;
+
+    for (size_t stars = benchMinStars; stars <= benchMaxStars; stars *= 10) {
+        SimulationContext ctx;
+        ctx.observerVelocity = settings.observerVelocity;
+        size_t both = stars * MODEL_COUNT;
+
+        results.push_back(timeKernel(counters, "initializeStars", "scalar", stars, both, sizeof(Star), [&]() {
+            initializeStars(ctx, settings.seed, stars);
+        }));
+
+        std::vector<float> wavelengths(stars);
+        std::vector<float> rgb(stars * 3);
+        std::mt19937 generator(settings.seed);
+        std::uniform_real_distribution<float> wavelength(0.0f, 1.0f);
+        for (float& value : wavelengths) value = wavelength(generator);
+        results.push_back(timeKernel(counters, "wavelengthToRGB", "scalar", stars, stars, 4 * sizeof(float), [&]() {
+            for (size_t i = 0; i < stars; i++) wavelengthToRGB(wavelengths[i], &rgb[i * 3]);
+        }));
+#ifdef RDE_HAVE_SSE2
+        results.push_back(timeKernel(counters, "wavelengthToRGB", "sse2", stars, stars, 4 * sizeof(float), [&]() {
+            wavelengthsToRGB(wavelengths.data(), rgb.data(), stars);
+        }));
+#endif
+        results.push_back(timeKernel(counters, "wavelengthToRGB", "threaded", stars, stars, 4 * sizeof(float), [&]() {
+            parallelFor(stars, [&](size_t begin, size_t end, unsigned int) {
+                for (size_t i = begin; i < end; i++) wavelengthToRGB(wavelengths[i], &rgb[i * 3]);
+            });
+        }));
+
+        const std::vector<Star>& keplerian = ctx.keplerianStars;
+        std::vector<float> factors(stars);
+        auto storeFactors = [&](size_t, size_t first, const float* blockFactors, size_t count) {
+            memcpy(&factors[first], blockFactors, count * sizeof(float));
+        };
+        results.push_back(timeKernel(counters, "dopplerFactor", "scalar", stars, stars, 4 * sizeof(float), [&]() {
+            for (size_t i = 0; i < stars; i++) factors[i] = calculateRelativisticDopplerShift(keplerian[i].velocity, observerVel);
+        }));
+#ifdef RDE_HAVE_SSE2
+        results.push_back(timeKernel(counters, "dopplerFactor", "sse2 batched", stars, stars, 4 * sizeof(float), [&]() {
+            dopplerFactorsForObservers(keplerian, 0, stars, observers, storeFactors);
+        }));
+#endif
+        results.push_back(timeKernel(counters, "dopplerFactor", "batched threaded", stars, stars, 4 * sizeof(float), [&]() {
+            parallelFor(stars, [&](size_t begin, size_t end, unsigned int) {
+                dopplerFactorsForObservers(keplerian, begin, end, observers, storeFactors);
+            });
+        }));
+
+        results.push_back(timeKernel(counters, "updateDopplerShifts", "scalar", stars, both, 6 * sizeof(float), [&]() {
+            updateDopplerShifts(ctx);
+        }));
+#ifdef RDE_HAVE_SSE2
+        results.push_back(timeKernel(counters, "updateDopplerShifts", "sse2 batched", stars, both, 6 * sizeof(float), [&]() {
+            updateDopplerShiftsBatched(ctx);
+        }));
+#endif
+        results.push_back(timeKernel(counters, "updateDopplerShifts", "threaded", stars, both, 6 * sizeof(float), [&]() {
+            updateDopplerShiftsThreaded(ctx);
+        }));
+    }
+
+    FILE* file = fopen(benchPath.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot create " << benchPath << std::endl;
+        return false;
+    }
+#ifdef RDE_HAVE_RDTSC
+    const char* cycleCounter = "rdtsc";
+#else
+    const char* cycleCounter = "none";
+#endif
+    fprintf(file, "{\n  \"version\": 1,\n  \"timestamp\": %lld,\n  \"threads\": %u,\n  \"seed\": %u,\n  \"cycle_counter\": \"%s\",\n",
+        (long long)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count(),
+        workers, settings.seed, cycleCounter);
+    fprintf(file, "  \"min_seconds\": %g,\n  \"results\": [\n", benchMinSeconds);
+    for (size_t r = 0; r < results.size(); r++) {
+        const BenchResult& result = results[r];
+        fprintf(file, "    {\"kernel\": \"%s\", \"variant\": \"%s\", \"stars\": %zu, \"seconds\": %.9g, \"stars_per_second\": %.9g, "
+            "\"bytes_per_star\": %g, \"cycles_per_star\": %.6g", result.kernel.c_str(), result.variant.c_str(), result.stars,
+            result.seconds, result.starsPerSecond, result.bytesPerStar, result.cyclesPerStar);
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            double value = result.countersPerStar[c];
+            if (std::isnan(value)) fprintf(file, ", \"%s_per_star\": null", PERF_COUNTER_NAMES[c]);
+            else fprintf(file, ", \"%s_per_star\": %.6g", PERF_COUNTER_NAMES[c], value);
+        }
+        fprintf(file, "}%s\n", r + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    if (fclose(file) != 0) {
+        std::cerr << "Cannot write " << benchPath << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << results.size() << " benchmark results to " << benchPath << std::endl;
+    return true;
+}
+
+// Scalability and roofline report
+// --scaling FILE sweeps worker counts 1, 2, 4, ... and the --bench-stars star
+// counts for the threaded Doppler colour update and the software renderer. At
+// every worker count it first measures the machine: STREAM-style copy, scale,
+// add and triad bandwidth over arrays far larger than any cache, and the SSE2
+// multiply-add rate. Each kernel's achieved bandwidth is then set against the
+// triad bandwidth and its flop rate against the roof min(peak flops,
+// intensity x triad bandwidth). Traffic counts whole Star records, since the
+// kernels touch every cache line of the array, plus the framebuffer merge for
+// rendering. Flops per star are counted by hand from the source.
+const size_t STREAM_ELEMENTS = 1 << 24;           // doubles per array, 128 MB
+const double DOPPLER_FLOPS_PER_STAR = 30.0;       // line of sight, Doppler factor, wavelength
+const double RENDER_FLOPS_PER_STAR = 30.0 + 40.0; // Doppler colour plus projection and viewport transform
+const double MEMORY_BOUND_FRACTION = 0.75;        // of triad bandwidth
+
+std::string scalingPath;
+
+struct MachineRoofs {
+    double copy, scale, add, triad; // bytes per second
+    double flops;                   // per second
+};
+
+// Best of a few STREAM passes per kernel on `workers` threads
+MachineRoofs measureMachineRoofs(unsigned int workers) {
+    std::vector<double> a(STREAM_ELEMENTS), b(STREAM_ELEMENTS), c(STREAM_ELEMENTS);
+    parallelFor(workers, STREAM_ELEMENTS, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            a[i] = 1.0;
+            b[i] = 2.0;
+            c[i] = 0.0;
+        }
+    });
+    const double scalar = 3.0;
+    auto best = [&](double bytesPerElement, auto kernel) {
+        double fastest = std::numeric_limits<double>::max();
+        for (int pass = 0; pass < 5; pass++) {
+            auto start = std::chrono::steady_clock::now();
+            parallelFor(workers, STREAM_ELEMENTS, kernel);
+            fastest = std::min(fastest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        return bytesPerElement * STREAM_ELEMENTS / fastest;
+    };
+    MachineRoofs roofs;
+    roofs.copy = best(16.0, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) c[i] = a[i];
+    });
+    roofs.scale = best(16.0, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) b[i] = scalar * c[i];
+    });
+    roofs.add = best(24.0, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) c[i] = a[i] + b[i];
+    });
+    roofs.triad = best(24.0, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) a[i] = b[i] + scalar * c[i];
+    });
+
+    // Eight independent multiply-add chains per worker keep the floating point units busy
+    const size_t iterations = 1 << 22;
+    std::vector<float> sinks(workers);
+    auto start = std::chrono::steady_clock::now();
+    parallelFor(workers, workers, [&](size_t, size_t, unsigned int worker) {
+#ifdef RDE_HAVE_SSE2
+        __m128 accumulators[8];
+        for (int k = 0; k < 8; k++) accumulators[k] = _mm_set1_ps((float)k);
+        const __m128 multiplier = _mm_set1_ps(0.999999f), addend = _mm_set1_ps(1e-6f);
+        for (size_t i = 0; i < iterations; i++) {
+            for (int k = 0; k < 8; k++) accumulators[k] = _mm_add_ps(_mm_mul_ps(accumulators[k], multiplier), addend);
+        }
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, _mm_add_ps(_mm_add_ps(accumulators[0], accumulators[7]), accumulators[3]));
+        sinks[worker] = lanes[0];
+#else
+        float accumulators[32];
+        for (int k = 0; k < 32; k++) accumulators[k] = (float)k;
+        for (size_t i = 0; i < iterations; i++) {
+            for (int k = 0; k < 32; k++) accumulators[k] = accumulators[k] * 0.999999f + 1e-6f;
+        }
+        sinks[worker] = accumulators[0] + accumulators[31];
+#endif
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    roofs.flops = 2.0 * 32.0 * iterations * workers / seconds;
+    if (std::isnan(sinks[0])) std::cerr << std::endl; // keeps the loop from being optimized away
+    return roofs;
+}
+
+struct ScalingResult {
+    const char* kernel;
+    unsigned int threads;
+    size_t stars;
+    BenchResult timing;
+    double flopsPerStar;
+    MachineRoofs roofs;
+
+    double intensity() const { return flopsPerStar / timing.bytesPerStar; }
+    double bandwidth() const { return timing.starsPerSecond * timing.bytesPerStar; }
+    double flops() const { return timing.starsPerSecond * flopsPerStar; }
+    double roof() const { return std::min(roofs.flops, intensity() * roofs.triad); }
+};
+
+bool runScalingBenchmark(const SimulationContext& settings) {
+    glm::vec3 observerVel(0.0f, 0.0f, settings.observerVelocity);
+    int panelWidth = windowWidth / 2;
+    glm::mat4 viewProjection = panelViewProjection(panelWidth, windowHeight);
+    size_t pixels = (size_t)windowWidth * windowHeight;
+    PerfCounters counters;
+    counters.open();
+
+    SimulationContext ctx;
+    ctx.observerVelocity = settings.observerVelocity;
+    std::vector<ScalingResult> results;
+    size_t largestStars = 0; // the sweep only visits benchMinStars times powers of ten
+    unsigned int maxThreads = workerThreadCount(settings.threads);
+    for (unsigned int threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        ctx.threads = threads;
+        MachineRoofs roofs = measureMachineRoofs(threads);
+        printf("%u threads: STREAM copy %.2f, scale %.2f, add %.2f, triad %.2f GB/s; peak %.2f GFLOP/s\n", threads, roofs.copy / 1e9,
+            roofs.scale / 1e9, roofs.add / 1e9, roofs.triad / 1e9, roofs.flops / 1e9);
+        std::vector<SoftwareFramebuffer> framebuffers(threads);
+
+        for (size_t stars = benchMinStars; stars <= benchMaxStars; stars *= 10) {
+            if (ctx.keplerianStars.size() != stars) initializeStars(ctx, settings.seed, stars);
+            size_t both = stars * MODEL_COUNT;
+            largestStars = std::max(largestStars, stars);
+            std::string variant = std::to_string(threads) + " threads";
+
+            ScalingResult doppler = { "updateDopplerShifts", threads, stars, {}, DOPPLER_FLOPS_PER_STAR, roofs };
+            doppler.timing = timeKernel(counters, doppler.kernel, variant.c_str(), stars, both, 2.0 * sizeof(Star), [&]() {
+                updateDopplerShiftsThreaded(ctx);
+            });
+            results.push_back(doppler);
+
+            // A frame clears every worker's framebuffer (colour, depth and velocity), splats, then merges them
+            double frameBytes = pixels * 5.0 * sizeof(float) * (threads + 2.0 * (threads - 1));
+            ScalingResult render = { "render", threads, stars, {}, RENDER_FLOPS_PER_STAR, roofs };
+            render.timing = timeKernel(counters, render.kernel, variant.c_str(), stars, both, sizeof(Star) + frameBytes / both, [&]() {
+                for (auto& framebuffer : framebuffers) framebuffer.resize(windowWidth, windowHeight);
+                parallelFor(threads, stars, [&](size_t begin, size_t end, unsigned int worker) {
+                    for (int model = 0; model < MODEL_COUNT; model++) {
+                        const std::vector<Star>& modelStars = starsForModel(ctx, model);
+                        for (size_t i = begin; i < end; i++) {
+                            float rgb[3];
+                            float radialVelocity;
+                            dopplerShiftedStarColor(modelStars[i].velocity, observerVel, rgb, &radialVelocity);
+                            splatStar(framebuffers[worker], model * panelWidth, panelWidth, viewProjection, modelStars[i].position, rgb,
+                                radialVelocity);
+                        }
+                    }
+                });
+                for (unsigned int worker = 1; worker < threads; worker++) {
+                    mergeFramebuffer(framebuffers[0], framebuffers[worker]);
+                }
+            });
+            results.push_back(render);
+        }
+        if (threads == maxThreads) break;
+    }
+
+    FILE* file = fopen(scalingPath.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot create " << scalingPath << std::endl;
+        return false;
+    }
+    fprintf(file, "kernel,threads,stars,seconds,stars_per_second,bytes_per_star,flops_per_star,arithmetic_intensity,"
+        "gb_per_second,stream_triad_gb_per_second,bandwidth_fraction,gflops,peak_gflops,roof_gflops,roof_fraction\n");
+    for (const ScalingResult& result : results) {
+        fprintf(file, "%s,%u,%zu,%.9g,%.9g,%.6g,%g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n", result.kernel, result.threads, result.stars,
+            result.timing.seconds, result.timing.starsPerSecond, result.timing.bytesPerStar, result.flopsPerStar, result.intensity(),
+            result.bandwidth() / 1e9, result.roofs.triad / 1e9, result.bandwidth() / result.roofs.triad, result.flops() / 1e9,
+            result.roofs.flops / 1e9, result.roof() / 1e9, result.flops() / result.roof());
+    }
+    if (fclose(file) != 0) {
+        std::cerr << "Cannot write " << scalingPath << std::endl;
+        return false;
+    }
+
+    // Roofline summary at the largest star count
+    printf("\nRoofline at %zu stars per model (ridge = peak flops / triad bandwidth)\n", largestStars);
+    printf("%-20s %7s %9s %9s %8s %9s %8s %8s  %s\n", "kernel", "threads", "flop/B", "GB/s", "%triad", "GFLOP/s", "%roof", "ridge",
+        "roof");
+    for (const char* kernel : { "updateDopplerShifts", "render" }) {
+        unsigned int memoryBoundFrom = 0;
+        for (const ScalingResult& result : results) {
+            if (strcmp(result.kernel, kernel) != 0 || result.stars != largestStars) continue;
+            double ridge = result.roofs.flops / result.roofs.triad;
+            double fraction = result.bandwidth() / result.roofs.triad;
+            if (fraction >= MEMORY_BOUND_FRACTION && memoryBoundFrom == 0) memoryBoundFrom = result.threads;
+            printf("%-20s %7u %9.3f %9.2f %7.1f%% %9.2f %7.1f%% %8.3f  %s\n", kernel, result.threads, result.intensity(),
+                result.bandwidth() / 1e9, 100.0 * fraction, result.flops() / 1e9, 100.0 * result.flops() / result.roof(), ridge,
+                result.intensity() < ridge ? "bandwidth" : "compute");
+        }
+        if (memoryBoundFrom > 0) {
+            printf("%s saturates memory bandwidth (>= %.0f%% of triad) from %u threads\n", kernel, 100.0 * MEMORY_BOUND_FRACTION,
+                memoryBoundFrom);
+        }
+        else {
+            printf("%s stays below %.0f%% of triad bandwidth at every thread count\n", kernel, 100.0 * MEMORY_BOUND_FRACTION);
+        }
+    }
+    std::cout << "Wrote " << results.size() << " scaling results to " << scalingPath << std::endl;
+    return true;
+}
@@ -0,0 +1,764 @@
+#pragma once
+// Catalog import and export: CSV catalogs, per-star Doppler tables, the software
+// renderer and FITS images
+
+// CSV catalog importer
+// Reads survey exports with a header row naming the columns x, y, z, vx, vy, vz
+// (other columns are ignored). The file is memory-mapped and split at line
+// boundaries into one range per worker; a first pass counts the rows of each
+// range so the second pass can parse straight into the final star slots.
+// An imported catalog carries one measured velocity field, so both panels
+// show the same stars.
+std::string importCsvPath;
+float importPositionScale = 1.0f;
+float importVelocityScale = 1.0f; // e.g. 1/299792.458 for velocities in km/s
+
+const int CSV_COLUMN_COUNT = 6;
+const char* const CSV_COLUMN_NAMES[CSV_COLUMN_COUNT] = { "x", "y", "z", "vx", "vy", "vz" };
+
+struct TextRange {
+    const char* begin;
+    const char* end;
+};
+
+// Trim spaces, tabs, carriage returns and surrounding quotes from a field
+TextRange trimCsvField(const char* begin, const char* end) {
+    while (begin < end && (*begin == ' ' || *begin == '\t' || *begin == '"')) begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '"')) end--;
+    return { begin, end };
+}
+
+bool parseCsvFloat(TextRange field, float& value) {
+    if (field.begin < field.end && *field.begin == '+') field.begin++;
+    auto result = std::from_chars(field.begin, field.end, value);
+    return result.ec == std::errc() && result.ptr == field.end;
+}
+
+size_t countCsvRows(const char* begin, const char* end) {
+    size_t rows = 0;
+    const char* line = begin;
+    while (line < end) {
+        const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+        const char* lineEnd = newline ? newline : end;
+        TextRange trimmed = trimCsvField(line, lineEnd);
+        if (trimmed.begin < trimmed.end) rows++;
+        line = lineEnd + 1;
+    }
+    return rows;
+}
+
+bool importCatalogCSV(SimulationContext& ctx, const std::string& path) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile mapped;
+    if (!mapped.open(path)) {
+        std::cerr << "Cannot open catalog " << path << std::endl;
+        return false;
+    }
+    const char* text = reinterpret_cast<const char*>(mapped.data);
+    const char* textEnd = text + mapped.size;
+    if (mapped.size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0) text += 3; // UTF-8 byte order mark
+
+    // Map the header names onto the fields we need
+    const char* headerEnd = static_cast<const char*>(memchr(text, '\n', textEnd - text));
+    if (!headerEnd) headerEnd = textEnd;
+    std::vector<int> fieldToColumn;
+    int found[CSV_COLUMN_COUNT] = {};
+    for (const char* field = text; field <= headerEnd; ) {
+        const char* comma = static_cast<const char*>(memchr(field, ',', headerEnd - field));
+        const char* fieldEnd = comma ? comma : headerEnd;
+        TextRange name = trimCsvField(field, fieldEnd);
+        int column = -1;
+        for (int c = 0; c < CSV_COLUMN_COUNT; c++) {
+            size_t length = strlen(CSV_COLUMN_NAMES[c]);
+            if ((size_t)(name.end - name.begin) == length && strncmp(name.begin, CSV_COLUMN_NAMES[c], length) == 0) {
+                column = c;
+                found[c]++;
+            }
+        }
+        fieldToColumn.push_back(column);
+        field = fieldEnd + 1;
+    }
+    for (int c = 0; c < CSV_COLUMN_COUNT; c++) {
+        if (found[c] != 1) {
+            std::cerr << "Catalog " << path << " needs exactly one '" << CSV_COLUMN_NAMES[c] << "' column" << std::endl;
+            return false;
+        }
+    }
+
+    // Split the data at line boundaries, one range per worker
+    const char* dataBegin = std::min(headerEnd + 1, textEnd);
+    size_t workers = workerThreadCount(ctx.threads);
+    std::vector<TextRange> ranges(workers);
+    const char* rangeBegin = dataBegin;
+    for (size_t w = 0; w < workers; w++) {
+        const char* rangeEnd = (w + 1 == workers) ? textEnd : dataBegin + (textEnd - dataBegin) * (w + 1) / workers;
+        if (rangeEnd < rangeBegin) rangeEnd = rangeBegin;
+        const char* newline = static_cast<const char*>(memchr(rangeEnd, '\n', textEnd - rangeEnd));
+        rangeEnd = newline ? newline + 1 : textEnd;
+        ranges[w] = { rangeBegin, rangeEnd };
+        rangeBegin = rangeEnd;
+    }
+
+    std::vector<size_t> rowOffsets(workers + 1, 0);
+    parallelFor(ctx.threads, workers, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t w = begin; w < end; w++) {
+            rowOffsets[w + 1] = countCsvRows(ranges[w].begin, ranges[w].end);
+        }
+    });
+    for (size_t w = 0; w < workers; w++) {
+        rowOffsets[w + 1] += rowOffsets[w];
+    }
+    size_t rowCount = rowOffsets[workers];
+
+    float baseColor[3];
+    wavelengthToRGB(0.5f, baseColor);
+    ctx.keplerianStars.assign(rowCount, Star());
+    ctx.flatRotationStars.assign(rowCount, Star());
+    std::vector<unsigned char> valid(rowCount, 1);
+
+    auto parseTime = std::chrono::steady_clock::now();
+    parallelFor(ctx.threads, workers, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t w = begin; w < end; w++) {
+            size_t row = rowOffsets[w];
+            const char* line = ranges[w].begin;
+            while (line < ranges[w].end) {
+                const char* newline = static_cast<const char*>(memchr(line, '\n', ranges[w].end - line));
+                const char* lineEnd = newline ? newline : ranges[w].end;
+                TextRange trimmed = trimCsvField(line, lineEnd);
+                line = lineEnd + 1;
+                if (trimmed.begin == trimmed.end) continue;
+
+                float values[CSV_COLUMN_COUNT] = {};
+                int parsed = 0;
+                size_t fieldIndex = 0;
+                for (const char* field = trimmed.begin; field <= trimmed.end && fieldIndex < fieldToColumn.size(); fieldIndex++) {
+                    const char* comma = static_cast<const char*>(memchr(field, ',', trimmed.end - field));
+                    const char* fieldEnd = comma ? comma : trimmed.end;
+                    int column = fieldToColumn[fieldIndex];
+                    if (column >= 0 && parseCsvFloat(trimCsvField(field, fieldEnd), values[column])) {
+                        parsed++;
+                    }
+                    field = fieldEnd + 1;
+                }
+
+                Star& star = ctx.keplerianStars[row];
+                star.position = glm::vec3(values[0], values[1], values[2]) * importPositionScale;
+                star.velocity = glm::vec3(values[3], values[4], values[5]) * importVelocityScale;
+                star.color = glm::vec3(baseColor[0], baseColor[1], baseColor[2]);
+                ctx.flatRotationStars[row] = star;
+                valid[row] = parsed == CSV_COLUMN_COUNT;
+                row++;
+            }
+        }
+    });
+    auto endTime = std::chrono::steady_clock::now();
+
+    // Drop rows with missing or malformed values (e.g. "null" in survey exports)
+    size_t kept = 0;
+    for (size_t i = 0; i < rowCount; i++) {
+        if (!valid[i]) continue;
+        ctx.keplerianStars[kept] = ctx.keplerianStars[i];
+        ctx.flatRotationStars[kept] = ctx.flatRotationStars[i];
+        kept++;
+    }
+    if (kept != rowCount) {
+        std::cerr << "Skipped " << (rowCount - kept) << " malformed rows in " << path << std::endl;
+        ctx.keplerianStars.resize(kept);
+        ctx.flatRotationStars.resize(kept);
+    }
+
+    updateDopplerShifts(ctx);
+
+    double gigabytes = (double)mapped.size / 1e9;
+    double parseSeconds = std::chrono::duration<double>(endTime - parseTime).count();
+    double totalSeconds = std::chrono::duration<double>(endTime - startTime).count();
+    std::cout << "Imported " << kept << " stars from " << path << " (" << gigabytes << " GB) in "
+        << totalSeconds << " s: " << gigabytes / totalSeconds << " GB/s overall, "
+        << gigabytes / parseSeconds << " GB/s parsing on " << workers << " threads" << std::endl;
+    return true;
+}
+
+// Doppler export
+// Writes the per-star quantities the viewer computes, for each model and each
+// requested observer velocity, as an export file: a header, a column table and
+// one page-aligned float32 column per (observer velocity, model, quantity).
+// Values are computed a chunk at a time and written with positional writes at
+// each column's offset, so nothing beyond two chunks of output is held in memory.
+// Quantities:
+//   radial velocity     line-of-sight velocity relative to the observer, fraction of c
+//   Doppler factor      λ' / λ
+//   shifted wavelength  0.5 * Doppler factor, unclamped (0 = 400 nm, 1 = 700 nm)
+//   colour index        red minus blue of the Doppler-shifted colour, positive when redder
+const char EXPORT_MAGIC[8] = { 'R', 'D', 'E', 'X', 'P', 'R', 'T', '\0' };
+const uint32_t EXPORT_VERSION = 1;
+const int EXPORT_MAX_OBSERVERS = 64;
+const size_t EXPORT_CHUNK_STARS = 1 << 16;
+
+enum ExportQuantity {
+    QUANTITY_RADIAL_VELOCITY = 0,
+    QUANTITY_DOPPLER_FACTOR = 1,
+    QUANTITY_SHIFTED_WAVELENGTH = 2,
+    QUANTITY_COLOUR_INDEX = 3,
+    QUANTITY_COUNT = 4
+};
+
+const char* const EXPORT_QUANTITY_NAMES[QUANTITY_COUNT] = { "radial_velocity", "doppler_factor", "shifted_wavelength", "colour_index" };
+
+struct ExportColumn {
+    uint32_t observerIndex;
+    uint32_t model;
+    uint32_t quantity;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t checksum;
+};
+
+struct ExportHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount; // ExportColumn entries directly after the header
+    uint64_t starCount;
+    uint32_t observerCount;
+    uint32_t reserved;
+    uint64_t headerChecksum; // covers the header and column table with this field zeroed
+    float observerVelocities[EXPORT_MAX_OBSERVERS];
+};
+
+std::string exportPath;
+std::string exportCsvPath;
+std::vector<float> exportObserverVelocities;
+
+// Comma-separated list of floats, e.g. "-0.5,0,0.5"
+std::vector<float> parseFloatList(const std::string& text) {
+    std::vector<float> values;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos) comma = text.size();
+        values.push_back(std::stof(text.substr(start, comma - start)));
+        start = comma + 1;
+    }
+    return values;
+}
+
+uint64_t exportHeaderChecksum(ExportHeader header, const std::vector<ExportColumn>& columns) {
+    header.headerChecksum = 0;
+    uint64_t hash = snapshotChecksum(&header, sizeof(header));
+    return snapshotChecksum(columns.data(), columns.size() * sizeof(ExportColumn), hash);
+}
+
+bool exportDopplerResults(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<float> velocities = exportObserverVelocities;
+    if (velocities.empty()) velocities.push_back(ctx.observerVelocity);
+    if (velocities.size() > (size_t)EXPORT_MAX_OBSERVERS) {
+        std::cerr << "At most " << EXPORT_MAX_OBSERVERS << " observer velocities can be exported" << std::endl;
+        return false;
+    }
+
+    size_t starCount = ctx.keplerianStars.size();
+    ExportHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EXPORT_MAGIC, sizeof(header.magic));
+    header.version = EXPORT_VERSION;
+    header.starCount = starCount;
+    header.observerCount = (uint32_t)velocities.size();
+    for (size_t o = 0; o < velocities.size(); o++) {
+        header.observerVelocities[o] = velocities[o];
+    }
+
+    std::vector<ExportColumn> columns;
+    uint64_t offset = alignSnapshotOffset(sizeof(ExportHeader) + velocities.size() * MODEL_COUNT * QUANTITY_COUNT * sizeof(ExportColumn));
+    for (size_t o = 0; o < velocities.size(); o++) {
+        for (int model = 0; model < MODEL_COUNT; model++) {
+            for (int quantity = 0; quantity < QUANTITY_COUNT; quantity++) {
+                ExportColumn column = {};
+                column.observerIndex = (uint32_t)o;
+                column.model = (uint32_t)model;
+                column.quantity = (uint32_t)quantity;
+                column.offset = offset;
+                column.bytes = starCount * sizeof(float);
+                column.checksum = snapshotChecksum(nullptr, 0);
+                columns.push_back(column);
+                offset = alignSnapshotOffset(offset + column.bytes);
+            }
+        }
+    }
+    header.columnCount = (uint32_t)columns.size();
+
+    AsyncFileIO io;
+    if (!exportPath.empty() && !io.open(exportPath, true)) {
+        std::cerr << "Cannot create export " << exportPath << std::endl;
+        return false;
+    }
+    FILE* csv = nullptr;
+    if (!exportCsvPath.empty()) {
+        csv = fopen(exportCsvPath.c_str(), "wb");
+        if (!csv) {
+            std::cerr << "Cannot create " << exportCsvPath << std::endl;
+            return false;
+        }
+        fprintf(csv, "star,model,observer_velocity,radial_velocity,doppler_factor,shifted_wavelength,colour_index\n");
+    }
+
+    // Two sets of chunk buffers: one is filled while the other is being written
+    std::vector<float> buffers[2];
+    buffers[0].resize(columns.size() * EXPORT_CHUNK_STARS);
+    buffers[1].resize(columns.size() * EXPORT_CHUNK_STARS);
+    std::vector<uint64_t> tickets[2];
+    std::string csvText;
+    int current = 0;
+    bool ok = true;
+
+    for (size_t begin = 0; begin < starCount && ok; begin += EXPORT_CHUNK_STARS) {
+        size_t count = std::min(EXPORT_CHUNK_STARS, starCount - begin);
+        for (uint64_t ticket : tickets[current]) {
+            ok = io.wait(ticket) && ok;
+        }
+        tickets[current].clear();
+
+        float* chunk = buffers[current].data();
+        parallelFor(ctx.threads, count, [&](size_t first, size_t last, unsigned int) {
+            for (size_t o = 0; o < velocities.size(); o++) {
+                glm::vec3 observerVel(0.0f, 0.0f, velocities[o]);
+                for (int model = 0; model < MODEL_COUNT; model++) {
+                    const std::vector<Star>& stars = starsForModel(ctx, model);
+                    float* out = chunk + ((o * MODEL_COUNT + model) * QUANTITY_COUNT) * EXPORT_CHUNK_STARS;
+                    for (size_t i = first; i < last; i++) {
+                        float radialVelocity = lineOfSightVelocity(stars[begin + i].velocity, observerVel);
+                        float dopplerFactor = relativisticDopplerFactor(radialVelocity);
+                        float shiftedWavelength = 0.5f * dopplerFactor;
+                        float rgb[3];
+                        wavelengthToRGB(glm::clamp(shiftedWavelength, 0.0f, 1.0f), rgb);
+                        out[QUANTITY_RADIAL_VELOCITY * EXPORT_CHUNK_STARS + i] = radialVelocity;
+                        out[QUANTITY_DOPPLER_FACTOR * EXPORT_CHUNK_STARS + i] = dopplerFactor;
+                        out[QUANTITY_SHIFTED_WAVELENGTH * EXPORT_CHUNK_STARS + i] = shiftedWavelength;
+                        out[QUANTITY_COLOUR_INDEX * EXPORT_CHUNK_STARS + i] = rgb[0] - rgb[2];
+                    }
+                }
+            }
+        });
+
+        for (size_t c = 0; c < columns.size() && !exportPath.empty(); c++) {
+            const float* values = chunk + c * EXPORT_CHUNK_STARS;
+            columns[c].checksum = snapshotChecksum(values, count * sizeof(float), columns[c].checksum);
+            tickets[current].push_back(io.submitWrite(columns[c].offset + begin * sizeof(float), values, count * sizeof(float)));
+        }
+
+        if (csv) {
+            csvText.clear();
+            char line[256];
+            for (size_t o = 0; o < velocities.size(); o++) {
+                for (int model = 0; model < MODEL_COUNT; model++) {
+                    const float* out = chunk + ((o * MODEL_COUNT + model) * QUANTITY_COUNT) * EXPORT_CHUNK_STARS;
+                    for (size_t i = 0; i < count; i++) {
+                        int length = snprintf(line, sizeof(line), "%zu,%s,%g,%.7g,%.7g,%.7g,%.7g\n", begin + i,
+                            model == MODEL_KEPLERIAN ? "keplerian" : "flat", velocities[o],
+                            out[i], out[EXPORT_CHUNK_STARS + i], out[2 * EXPORT_CHUNK_STARS + i], out[3 * EXPORT_CHUNK_STARS + i]);
+                        csvText.append(line, (size_t)length);
+                    }
+                }
+            }
+            ok = fwrite(csvText.data(), 1, csvText.size(), csv) == csvText.size() && ok;
+        }
+        current ^= 1;
+    }
+
+    for (int b = 0; b < 2; b++) {
+        for (uint64_t ticket : tickets[b]) {
+            ok = io.wait(ticket) && ok;
+        }
+    }
+    if (!exportPath.empty()) {
+        header.headerChecksum = exportHeaderChecksum(header, columns);
+        ok = ok && io.wait(io.submitWrite(0, &header, sizeof(header)));
+        if (!columns.empty()) {
+            ok = ok && io.wait(io.submitWrite(sizeof(header), columns.data(), columns.size() * sizeof(ExportColumn)));
+        }
+        ok = io.close() && ok;
+    }
+    if (csv) {
+        ok = (fclose(csv) == 0) && ok;
+    }
+    if (!ok) {
+        std::cerr << "Failed writing Doppler export" << std::endl;
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Exported " << starCount << " stars x " << MODEL_COUNT << " models x " << velocities.size()
+        << " observer velocities in " << seconds << " s" << std::endl;
+    return true;
+}
+
+// Software renderer
+// Draws stars as single pixels with a depth test through the same camera as
+// display(), so images can be produced headless and without the star arrays.
+struct SoftwareFramebuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<float> color;    // RGB rows, bottom row first like glReadPixels
+    std::vector<float> depth;
+    std::vector<float> velocity; // radial velocity of the visible star, NaN where empty
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        color.assign((size_t)w * h * 3, 0.0f);
+        depth.assign((size_t)w * h, 1.0f);
+        velocity.assign((size_t)w * h, std::numeric_limits<float>::quiet_NaN());
+        for (size_t i = 0; i < (size_t)w * h; i++) {
+            color[i * 3 + 2] = 0.1f; // glClearColor
+        }
+    }
+};
+
+// The gluLookAt() camera of display()
+glm::mat4 cameraView() {
+    return glm::lookAt(glm::vec3(0.0f, 10.0f, OBSERVER_POSITION_Z),
+        glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+glm::mat4 panelViewProjection(int panelWidth, int panelHeight) {
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)panelWidth / (float)panelHeight, 0.1f, 100.0f);
+    return projection * cameraView();
+}
+
+void splatStar(SoftwareFramebuffer& framebuffer, int panelX, int panelWidth, const glm::mat4& viewProjection,
+    const glm::vec3& position, const float rgb[3], float radialVelocity) {
+    glm::vec4 clip = viewProjection * glm::vec4(position, 1.0f);
+    if (clip.w <= 0.0f) return;
+    float ndcX = clip.x / clip.w;
+    float ndcY = clip.y / clip.w;
+    float ndcZ = clip.z / clip.w;
+    if (ndcX < -1.0f || ndcX >= 1.0f || ndcY < -1.0f || ndcY >= 1.0f || ndcZ < -1.0f || ndcZ > 1.0f) return;
+
+    int x = panelX + (int)((ndcX * 0.5f + 0.5f) * panelWidth);
+    int y = (int)((ndcY * 0.5f + 0.5f) * framebuffer.height);
+    size_t pixel = (size_t)y * framebuffer.width + x;
+    float depth = ndcZ * 0.5f + 0.5f;
+    if (depth < framebuffer.depth[pixel]) {
+        framebuffer.depth[pixel] = depth;
+        framebuffer.color[pixel * 3 + 0] = rgb[0];
+        framebuffer.color[pixel * 3 + 1] = rgb[1];
+        framebuffer.color[pixel * 3 + 2] = rgb[2];
+        framebuffer.velocity[pixel] = radialVelocity;
+    }
+}
+
+// Combine a worker's framebuffer into the target, keeping the nearest star at each pixel
+void mergeFramebuffer(SoftwareFramebuffer& target, const SoftwareFramebuffer& source) {
+    for (size_t pixel = 0; pixel < target.depth.size(); pixel++) {
+        if (source.depth[pixel] < target.depth[pixel]) {
+            target.depth[pixel] = source.depth[pixel];
+            memcpy(&target.color[pixel * 3], &source.color[pixel * 3], 3 * sizeof(float));
+            target.velocity[pixel] = source.velocity[pixel];
+        }
+    }
+}
+
+// FITS output
+// FitsWriter streams a single float32 (BITPIX = -32) primary HDU. The header is
+// built from the axes, their linear WCS and any extra cards; data is passed in
+// FITS order (first axis fastest) in as many write() calls as convenient. Each
+// piece is byte-swapped a block at a time into one of a few reusable buffers
+// and written by AsyncFileIO in the background, so no big-endian copy of the
+// whole dataset is ever made.
+const size_t FITS_RECORD = 2880;
+const size_t FITS_BLOCK_VALUES = 1 << 20;
+const int FITS_BUFFERS = 3;
+
+struct FitsAxis {
+    uint64_t length;
+    std::string type;  // CTYPE
+    std::string unit;  // CUNIT
+    double referencePixel; // CRPIX, 1-based
+    double referenceValue; // CRVAL
+    double increment;      // CDELT
+};
+
+std::string fitsCard(const std::string& key, const std::string& value, const std::string& comment) {
+    char card[128];
+    if (!value.empty() && value[0] == '\'') {
+        snprintf(card, sizeof(card), "%-8.8s= %-20s / %s", key.c_str(), value.c_str(), comment.c_str());
+    }
+    else {
+        snprintf(card, sizeof(card), "%-8.8s= %20s / %s", key.c_str(), value.c_str(), comment.c_str());
+    }
+    std::string text(card);
+    text.resize(80, ' ');
+    return text;
+}
+
+std::string fitsString(const std::string& value) {
+    std::string quoted = value;
+    if (quoted.size() < 8) quoted.resize(8, ' ');
+    return "'" + quoted + "'";
+}
+
+std::string fitsNumber(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.10G", value);
+    return text;
+}
+
+std::string fitsInteger(uint64_t value) {
+    return std::to_string(value);
+}
+
+uint32_t byteSwap32(uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xff00u) | ((value << 8) & 0xff0000u) | (value << 24);
+}
+
+class FitsWriter {
+public:
+    bool open(const std::string& path, const std::vector<FitsAxis>& axes, const std::string& unit,
+        const std::vector<std::string>& extraCards) {
+        if (!io.open(path, true)) {
+            std::cerr << "Cannot create " << path << std::endl;
+            return false;
+        }
+
+        std::string header;
+        header += fitsCard("SIMPLE", "T", "conforms to FITS standard");
+        header += fitsCard("BITPIX", "-32", "IEEE single precision");
+        header += fitsCard("NAXIS", fitsInteger(axes.size()), "number of axes");
+        expectedValues = 1;
+        for (size_t a = 0; a < axes.size(); a++) {
+            std::string n = std::to_string(a + 1);
+            header += fitsCard("NAXIS" + n, fitsInteger(axes[a].length), "");
+            expectedValues *= axes[a].length;
+        }
+        header += fitsCard("BUNIT", fitsString(unit), "data unit");
+        for (size_t a = 0; a < axes.size(); a++) {
+            std::string n = std::to_string(a + 1);
+            header += fitsCard("CTYPE" + n, fitsString(axes[a].type), "");
+            if (!axes[a].unit.empty()) header += fitsCard("CUNIT" + n, fitsString(axes[a].unit), "");
+            header += fitsCard("CRPIX" + n, fitsNumber(axes[a].referencePixel), "");
+            header += fitsCard("CRVAL" + n, fitsNumber(axes[a].referenceValue), "");
+            header += fitsCard("CDELT" + n, fitsNumber(axes[a].increment), "");
+        }
+        header += fitsCard("ORIGIN", fitsString("relativistic_doppler_effect"), "");
+        for (const auto& card : extraCards) {
+            header += card;
+        }
+        header += std::string("END").append(77, ' ');
+        header.resize((header.size() + FITS_RECORD - 1) / FITS_RECORD * FITS_RECORD, ' ');
+
+        headerText = header;
+        headerTicket = io.submitWrite(0, headerText.data(), headerText.size());
+        offset = headerText.size();
+        writtenValues = 0;
+        ok = true;
+        for (int b = 0; b < FITS_BUFFERS; b++) {
+            buffers[b].resize(FITS_BLOCK_VALUES);
+            tickets[b] = 0;
+        }
+        current = 0;
+        return true;
+    }
+
+    // Append values in FITS order
+    void write(const float* values, size_t count) {
+        while (count > 0) {
+            size_t block = std::min(count, FITS_BLOCK_VALUES);
+            if (tickets[current]) {
+                ok = io.wait(tickets[current]) && ok;
+                tickets[current] = 0;
+            }
+            uint32_t* out = buffers[current].data();
+            for (size_t i = 0; i < block; i++) {
+                uint32_t bits;
+                memcpy(&bits, &values[i], sizeof(bits));
+                out[i] = byteSwap32(bits);
+            }
+            tickets[current] = io.submitWrite(offset, out, block * sizeof(uint32_t));
+            offset += block * sizeof(uint32_t);
+            writtenValues += block;
+            values += block;
+            count -= block;
+            current = (current + 1) % FITS_BUFFERS;
+        }
+    }
+
+    // Pad the data to a whole FITS record and finish writing
+    bool close() {
+        if (writtenValues != expectedValues) {
+            std::cerr << "FITS data has " << writtenValues << " values, expected " << expectedValues << std::endl;
+            ok = false;
+        }
+        static const char zeros[FITS_RECORD] = {};
+        size_t padding = (size_t)((FITS_RECORD - offset % FITS_RECORD) % FITS_RECORD);
+        if (padding > 0) {
+            ok = io.wait(io.submitWrite(offset, zeros, padding)) && ok;
+        }
+        for (int b = 0; b < FITS_BUFFERS; b++) {
+            if (tickets[b]) ok = io.wait(tickets[b]) && ok;
+            tickets[b] = 0;
+        }
+        if (headerTicket) ok = io.wait(headerTicket) && ok;
+        headerTicket = 0;
+        return io.close() && ok;
+    }
+
+private:
+    AsyncFileIO io;
+    std::string headerText;
+    uint64_t headerTicket = 0;
+    std::vector<uint32_t> buffers[FITS_BUFFERS];
+    uint64_t tickets[FITS_BUFFERS] = {};
+    int current = 0;
+    uint64_t offset = 0;
+    uint64_t expectedValues = 0;
+    uint64_t writtenValues = 0;
+    bool ok = true;
+};
+
+// Write a whole float array as one FITS image with the given axes
+bool writeFitsImage(const std::string& path, const float* values, const std::vector<FitsAxis>& axes,
+    const std::string& unit, const std::vector<std::string>& extraCards) {
+    FitsWriter writer;
+    if (!writer.open(path, axes, unit, extraCards)) {
+        return false;
+    }
+    uint64_t count = 1;
+    for (const auto& axis : axes) count *= axis.length;
+    writer.write(values, (size_t)count);
+    return writer.close();
+}
+
+// Minimal FITS reader for float32 primary images like the ones written above
+struct FitsImage {
+    std::vector<uint64_t> axes;
+    std::vector<float> data;
+    std::unordered_map<std::string, std::string> cards; // keyword -> value text
+
+    double number(const std::string& key, double fallback) const {
+        auto card = cards.find(key);
+        if (card == cards.end()) return fallback;
+        try {
+            return std::stod(card->second);
+        }
+        catch (const std::exception&) {
+            return fallback;
+        }
+    }
+};
+
+bool readFitsImage(const std::string& path, FitsImage& image) {
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+    const char* text = reinterpret_cast<const char*>(file.data);
+    uint64_t headerEnd = 0;
+    for (uint64_t offset = 0; offset + 80 <= file.size; offset += 80) {
+        std::string card(text + offset, 80);
+        std::string key = card.substr(0, 8);
+        key.erase(key.find_last_not_of(' ') + 1);
+        if (key == "END") {
+            headerEnd = (offset + 80 + FITS_RECORD - 1) / FITS_RECORD * FITS_RECORD;
+            break;
+        }
+        if (card.compare(8, 2, "= ") != 0) continue;
+        std::string value = card.substr(10);
+        value.erase(0, value.find_first_not_of(' '));
+        if (!value.empty() && value[0] == '\'') {
+            value = value.substr(1, value.find('\'', 1) - 1); // strings keep no comment
+        }
+        else if (value.find('/') != std::string::npos) {
+            value.erase(value.find('/'));
+        }
+        value.erase(value.find_last_not_of(' ') + 1);
+        image.cards[key] = value;
+    }
+    if (headerEnd == 0 || image.cards["SIMPLE"] != "T" || image.number("BITPIX", 0) != -32) {
+        std::cerr << path << " is not a float32 FITS image" << std::endl;
+        return false;
+    }
+
+    uint64_t count = 1;
+    int axisCount = (int)image.number("NAXIS", 0);
+    for (int a = 1; a <= axisCount; a++) {
+        image.axes.push_back((uint64_t)image.number("NAXIS" + std::to_string(a), 0));
+        count *= image.axes.back();
+    }
+    if (axisCount == 0 || headerEnd + count * sizeof(float) > file.size) {
+        std::cerr << path << " is truncated" << std::endl;
+        return false;
+    }
+    image.data.resize((size_t)count);
+    const unsigned char* in = file.data + headerEnd;
+    for (size_t i = 0; i < image.data.size(); i++) {
+        uint32_t bits;
+        memcpy(&bits, in + i * sizeof(bits), sizeof(bits));
+        bits = byteSwap32(bits);
+        memcpy(&image.data[i], &bits, sizeof(bits));
+    }
+    return true;
+}
+
+bool hasExtension(const std::string& path, const std::string& extension) {
+    return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// Insert a suffix before a file's extension: render.fits -> render_velocity.fits
+std::string withSuffix(const std::string& path, const std::string& suffix) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path + suffix;
+    return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+// Write the rendered colours as an RGB cube and the velocity map as an image
+bool writeFramebufferFits(const std::string& path, const SoftwareFramebuffer& framebuffer, uint64_t starCount, float observerSpeed) {
+    std::vector<std::string> cards;
+    cards.push_back(fitsCard("OBSVEL", fitsNumber(observerSpeed), "observer velocity [c]"));
+    cards.push_back(fitsCard("NSTARS", fitsInteger(starCount), "stars per model"));
+    cards.push_back(fitsCard("PANELS", fitsString("KEPLERIAN,FLAT"), "left and right halves"));
+
+    // Perspective renders have no sky projection, so the spatial axes are plain pixels
+    FitsAxis x = { (uint64_t)framebuffer.width, "PIXEL", "", 1.0, 1.0, 1.0 };
+    FitsAxis y = { (uint64_t)framebuffer.height, "PIXEL", "", 1.0, 1.0, 1.0 };
+    FitsAxis channel = { 3, "RGB", "", 1.0, 1.0, 1.0 };
+
+    FitsWriter writer;
+    if (!writer.open(path, { x, y, channel }, "", cards)) {
+        return false;
+    }
+    std::vector<float> plane((size_t)framebuffer.width * framebuffer.height);
+    for (int c = 0; c < 3; c++) {
+        for (size_t pixel = 0; pixel < plane.size(); pixel++) {
+            plane[pixel] = framebuffer.color[pixel * 3 + c];
+        }
+        writer.write(plane.data(), plane.size());
+    }
+    if (!writer.close()) {
+        return false;
+    }
+
+    cards.push_back(fitsCard("BTYPE", fitsString("VRAD"), "radial velocity of nearest star"));
+    return writeFitsImage(withSuffix(path, "_velocity"), framebuffer.velocity.data(), { x, y }, "c", cards);
+}
+
+bool writePPM(const std::string& path, const SoftwareFramebuffer& framebuffer) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Cannot create image " << path << std::endl;
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", framebuffer.width, framebuffer.height);
+    std::vector<unsigned char> row((size_t)framebuffer.width * 3);
+    for (int y = framebuffer.height - 1; y >= 0; y--) {
+        const float* source = &framebuffer.color[(size_t)y * framebuffer.width * 3];
+        for (size_t i = 0; i < row.size(); i++) {
+            row[i] = (unsigned char)(glm::clamp(source[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    return fclose(file) == 0;
+}
@@ -0,0 +1,510 @@
+#pragma once
+// Orbit evolution, checkpoints and timeline recording and playback
+
+// Orbit evolution
+// Each step rotates a star's position and velocity about the galactic (y) axis
+// by its angular velocity times the time step. For the circular orbits the
+// generator produces this is exact, so orbits never drift however long the run.
+uint64_t evolveUntilStep = 0; // headless runs stop at this step
+
+// Advance source by dt into stars, which may be the same array
+void advanceStars(const std::vector<Star>& source, std::vector<Star>& stars, float dt, unsigned int threads) {
+    stars.resize(source.size());
+    parallelFor(threads, source.size(), [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            Star star = source[i];
+            float radiusSquared = star.position.x * star.position.x + star.position.z * star.position.z;
+            if (radiusSquared > 0.0f) {
+                float angularVelocity = (star.position.x * star.velocity.z - star.position.z * star.velocity.x) / radiusSquared;
+                float c = cos(angularVelocity * dt);
+                float s = sin(angularVelocity * dt);
+                glm::vec3 p = star.position;
+                glm::vec3 v = star.velocity;
+                star.position = glm::vec3(p.x * c - p.z * s, p.y, p.x * s + p.z * c);
+                star.velocity = glm::vec3(v.x * c - v.z * s, v.y, v.x * s + v.z * c);
+            }
+            stars[i] = star;
+        }
+    });
+}
+
+void writeCheckpoint(SimulationContext& ctx);
+void recordTimelineStep(SimulationContext& ctx);
+
+// Advance both models by one time step
+void advanceSimulation(SimulationContext& ctx) {
+    PhaseTimer timer(PHASE_EVOLVE);
+    if (ctx.checkpointReadsStars) {
+        // A checkpoint is still reading the current arrays: integrate into the
+        // spare arrays and swap, leaving its buffers untouched until it completes
+        advanceStars(ctx.keplerianStars, ctx.spareKeplerianStars, ctx.timeStep, ctx.threads);
+        advanceStars(ctx.flatRotationStars, ctx.spareFlatRotationStars, ctx.timeStep, ctx.threads);
+        ctx.keplerianStars.swap(ctx.spareKeplerianStars);
+        ctx.flatRotationStars.swap(ctx.spareFlatRotationStars);
+        ctx.checkpointReadsStars = false;
+    }
+    else {
+        advanceStars(ctx.keplerianStars, ctx.keplerianStars, ctx.timeStep, ctx.threads);
+        advanceStars(ctx.flatRotationStars, ctx.flatRotationStars, ctx.timeStep, ctx.threads);
+    }
+    ctx.simulationTime += ctx.timeStep;
+    ctx.simulationStep++;
+    updateDopplerShifts(ctx);
+    writeCheckpoint(ctx);
+    recordTimelineStep(ctx);
+}
+
+// Checkpoints
+// Every checkpointInterval steps the full simulation state is written as a
+// snapshot (raw columns, so restarts are bit-for-bit) whose state column holds
+// a CheckpointState followed by the random generator state as text. A
+// background task writes the star arrays in place, without copying them: the
+// step after a checkpoint integrates into a second pair of arrays and swaps
+// (vector swaps keep element addresses), so the simulation never pauses for
+// the write. One checkpoint is in flight at a time; if the previous one is
+// still writing when the next is due, the simulation waits for it rather than
+// skipping a checkpoint, which only happens when writes take longer than
+// checkpointInterval steps.
+std::string checkpointPrefix;
+uint64_t checkpointInterval = 0;
+std::string restartPath;
+
+const uint32_t CHECKPOINT_FLAG_SHOW_KEPLERIAN = 1;
+const uint32_t CHECKPOINT_FLAG_SHOW_FLAT_ROTATION = 2;
+const uint32_t CHECKPOINT_FLAG_EVOLVE = 4;
+
+struct CheckpointState {
+    uint64_t step;
+    double time;
+    float timeStep;
+    float observerVelocity;
+    float viewAngle;
+    uint32_t flags;
+    uint32_t generatorSeed;
+    uint32_t generatorSeedFixed;
+};
+
+std::string checkpointStatePath(uint64_t step) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%08llu.rdesnap", (unsigned long long)step);
+    return checkpointPrefix + suffix;
+}
+
+std::string serializeSimulationState(const SimulationContext& ctx) {
+    CheckpointState state;
+    memset(&state, 0, sizeof(state));
+    state.step = ctx.simulationStep;
+    state.time = ctx.simulationTime;
+    state.timeStep = ctx.timeStep;
+    state.observerVelocity = ctx.observerVelocity;
+    state.viewAngle = ctx.viewAngle;
+    state.flags = (ctx.showKeplerian ? CHECKPOINT_FLAG_SHOW_KEPLERIAN : 0) |
+        (ctx.showFlatRotation ? CHECKPOINT_FLAG_SHOW_FLAT_ROTATION : 0) |
+        (ctx.evolving ? CHECKPOINT_FLAG_EVOLVE : 0);
+    state.generatorSeed = ctx.seed;
+    state.generatorSeedFixed = ctx.seedFixed ? 1 : 0;
+
+    std::ostringstream generatorState;
+    generatorState << ctx.gen;
+    std::string bytes(reinterpret_cast<const char*>(&state), sizeof(state));
+    return bytes + generatorState.str();
+}
+
+bool restoreSimulationState(SimulationContext& ctx, const std::string& bytes) {
+    CheckpointState state;
+    if (bytes.size() < sizeof(state)) return false;
+    memcpy(&state, bytes.data(), sizeof(state));
+    std::istringstream generatorState(bytes.substr(sizeof(state)));
+    std::mt19937 restoredGenerator;
+    generatorState >> restoredGenerator;
+    if (generatorState.fail()) return false;
+
+    ctx.simulationStep = state.step;
+    ctx.simulationTime = state.time;
+    ctx.timeStep = state.timeStep;
+    ctx.observerVelocity = state.observerVelocity;
+    ctx.viewAngle = state.viewAngle;
+    ctx.showKeplerian = (state.flags & CHECKPOINT_FLAG_SHOW_KEPLERIAN) != 0;
+    ctx.showFlatRotation = (state.flags & CHECKPOINT_FLAG_SHOW_FLAT_ROTATION) != 0;
+    ctx.evolving = (state.flags & CHECKPOINT_FLAG_EVOLVE) != 0;
+    ctx.seed = state.generatorSeed;
+    ctx.seedFixed = state.generatorSeedFixed != 0;
+    ctx.gen = restoredGenerator;
+    return true;
+}
+
+// Wait for an outstanding checkpoint, e.g. before exiting
+bool finishCheckpoints(SimulationContext& ctx) {
+    ctx.checkpointReadsStars = false;
+    return ctx.pendingCheckpoint.valid() ? ctx.pendingCheckpoint.get() : true;
+}
+
+// Start writing a checkpoint if one is due
+void writeCheckpoint(SimulationContext& ctx) {
+    if (checkpointInterval == 0 || checkpointPrefix.empty() || ctx.simulationStep % checkpointInterval != 0) return;
+    finishCheckpoints(ctx);
+
+    const Star* keplerian = ctx.keplerianStars.data();
+    const Star* flatRotation = ctx.flatRotationStars.data();
+    size_t starCount = ctx.keplerianStars.size();
+    std::string state = serializeSimulationState(ctx);
+    std::string path = checkpointStatePath(ctx.simulationStep);
+    float savedObserverVelocity = ctx.observerVelocity;
+    ctx.checkpointReadsStars = true;
+    ctx.pendingCheckpoint = std::async(std::launch::async, [=]() {
+        return writeSnapshot(path, keplerian, flatRotation, starCount, savedObserverVelocity, 0.0f, state);
+    });
+}
+
+// Wait for a checkpoint still reading the current star arrays before they are
+// changed other than by advanceSimulation()
+void releaseCheckpointStars(SimulationContext& ctx) {
+    if (ctx.checkpointReadsStars) finishCheckpoints(ctx);
+}
+
+// Continue a run from a checkpoint written by writeCheckpoint()
+bool restartFromCheckpoint(SimulationContext& ctx, const std::string& path) {
+    std::string state;
+    if (!loadSnapshot(ctx, path, verifySnapshotChecksums, &state)) {
+        return false;
+    }
+    if (!restoreSimulationState(ctx, state)) {
+        std::cerr << path << " has no simulation state" << std::endl;
+        return false;
+    }
+    updateDopplerShifts(ctx);
+    std::cout << "Restarted at step " << ctx.simulationStep << ", time " << ctx.simulationTime << std::endl;
+    return true;
+}
+
+// Timeline recording and scrubbing
+// A timeline stores one record per evolution step: a full keyframe every
+// keyframeInterval steps and a delta record in between. Keyframes hold the
+// positions and velocities of both models as raw float32 columns. Delta records
+// hold, per column, a power-of-two scale and int16 quantized changes. Readers
+// keep each value as its keyframe value plus an integer offset in units of
+// 2^-TIMELINE_OFFSET_BITS, which every delta changes by an exact multiple, so
+// deltas can be added and undone without rounding. The recorder quantizes
+// against the state a reader will reconstruct rather than the exact previous
+// state, so quantization errors never accumulate across deltas. An index of
+// all records at the end of the file lets the player seek to any step from the
+// nearest earlier keyframe, or by undoing deltas when that is shorter, so a
+// step in either direction costs one delta.
+const char TIMELINE_MAGIC[8] = { 'R', 'D', 'E', 'T', 'I', 'M', 'L', '\0' };
+const uint32_t TIMELINE_VERSION = 1;
+const int TIMELINE_COLUMNS = MODEL_COUNT * 2 * 3; // positions and velocities
+const uint64_t TIMELINE_DATA_OFFSET = 64;
+const int TIMELINE_OFFSET_BITS = 40; // delta scales are at least 2^-40
+
+enum TimelineRecordType {
+    RECORD_KEYFRAME = 0,
+    RECORD_DELTA = 1
+};
+
+struct TimelineHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t keyframeInterval;
+    uint64_t starCount;
+    uint64_t recordCount;
+    uint64_t indexOffset;    // TimelineIndexEntry[recordCount]
+    uint64_t headerChecksum; // covers the header with this field zeroed and the index
+};
+
+struct TimelineIndexEntry {
+    uint64_t step;
+    uint64_t offset;
+    uint64_t bytes;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+std::string recordPath;
+std::string playPath;
+uint32_t keyframeInterval = 50;
+int64_t playSeekStep = -1; // headless seek with --play
+
+Star& timelineStar(SimulationContext& ctx, int column, size_t i) {
+    return starsForModel(ctx, column / 6)[i];
+}
+
+float& timelineComponent(SimulationContext& ctx, int column, size_t i) {
+    return starComponent(timelineStar(ctx, column, i), (column / 3) % 2 == 0 ? FIELD_POSITION : FIELD_VELOCITY, column % 3);
+}
+
+size_t timelineDeltaColumnBytes(size_t starCount) {
+    return sizeof(float) + (starCount * sizeof(int16_t) + 3) / 4 * 4;
+}
+
+uint64_t timelineChecksum(TimelineHeader header, const std::vector<TimelineIndexEntry>& index) {
+    header.headerChecksum = 0;
+    return snapshotChecksum(index.data(), index.size() * sizeof(TimelineIndexEntry), snapshotChecksum(&header, sizeof(header)));
+}
+
+// A reconstructed value: its keyframe value plus an offset in 2^-40 units
+float timelineValue(float keyframeValue, int64_t offset) {
+    return (float)((double)keyframeValue + std::ldexp((double)offset, -TIMELINE_OFFSET_BITS));
+}
+
+// Offset units per quantized step of a delta column with the given scale
+int64_t timelineDeltaUnit(float scale) {
+    return (int64_t)std::ldexp((double)scale, TIMELINE_OFFSET_BITS);
+}
+
+struct TimelineRecorder {
+    AsyncFileIO io;
+    bool active = false;
+    TimelineHeader header;
+    std::vector<TimelineIndexEntry> index;
+    std::vector<float> keyframeValues; // column-major, as of the last keyframe
+    std::vector<int64_t> offsets;      // a reader's offsets from it after the last record
+    std::vector<unsigned char> buffers[2];
+    uint64_t tickets[2] = { 0, 0 };
+    int current = 0;
+    uint64_t fileOffset = TIMELINE_DATA_OFFSET;
+    bool ok = true;
+
+    bool open(const SimulationContext& ctx, const std::string& path) {
+        if (!io.open(path, true)) {
+            std::cerr << "Cannot create timeline " << path << std::endl;
+            return false;
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TIMELINE_MAGIC, sizeof(header.magic));
+        header.version = TIMELINE_VERSION;
+        header.keyframeInterval = std::max<uint32_t>(keyframeInterval, 1);
+        header.starCount = ctx.keplerianStars.size();
+        index.clear();
+        fileOffset = TIMELINE_DATA_OFFSET;
+        ok = true;
+        active = true;
+        return true;
+    }
+
+    // Append the current state of both models as the record for this step
+    void append(SimulationContext& ctx, uint64_t step) {
+        size_t starCount = (size_t)header.starCount;
+        if (!active || ctx.keplerianStars.size() != starCount || ctx.flatRotationStars.size() != starCount) return;
+
+        if (tickets[current]) {
+            ok = io.wait(tickets[current]) && ok;
+            tickets[current] = 0;
+        }
+        std::vector<unsigned char>& buffer = buffers[current];
+        bool keyframe = index.empty() || step % header.keyframeInterval == 0;
+
+        if (keyframe) {
+            buffer.resize(TIMELINE_COLUMNS * starCount * sizeof(float));
+            keyframeValues.resize(TIMELINE_COLUMNS * starCount);
+            offsets.assign(TIMELINE_COLUMNS * starCount, 0);
+            float* out = reinterpret_cast<float*>(buffer.data());
+            parallelFor(ctx.threads, starCount, [&](size_t begin, size_t end, unsigned int) {
+                for (int c = 0; c < TIMELINE_COLUMNS; c++) {
+                    for (size_t i = begin; i < end; i++) {
+                        float value = timelineComponent(ctx, c, i);
+                        out[c * starCount + i] = value;
+                        keyframeValues[c * starCount + i] = value;
+                    }
+                }
+            });
+        }
+        else {
+            size_t columnBytes = timelineDeltaColumnBytes(starCount);
+            buffer.assign(TIMELINE_COLUMNS * columnBytes, 0);
+            parallelFor(ctx.threads, TIMELINE_COLUMNS, [&](size_t begin, size_t end, unsigned int) {
+                for (size_t c = begin; c < end; c++) {
+                    const float* base = &keyframeValues[c * starCount];
+                    int64_t* offset = &offsets[c * starCount];
+                    float maxChange = 0.0f;
+                    for (size_t i = 0; i < starCount; i++) {
+                        float change = timelineComponent(ctx, (int)c, i) - timelineValue(base[i], offset[i]);
+                        maxChange = std::max(maxChange, std::fabs(change));
+                    }
+                    // The smallest power of two that keeps every change within int16
+                    float scale = 0.0f;
+                    if (maxChange > 0.0f) {
+                        int exponent;
+                        std::frexp(maxChange / 32767.0f, &exponent);
+                        scale = std::ldexp(1.0f, std::max(exponent, -TIMELINE_OFFSET_BITS));
+                    }
+                    int64_t unit = timelineDeltaUnit(scale);
+                    unsigned char* out = buffer.data() + c * columnBytes;
+                    memcpy(out, &scale, sizeof(scale));
+                    int16_t* quantized = reinterpret_cast<int16_t*>(out + sizeof(float));
+                    for (size_t i = 0; i < starCount; i++) {
+                        float change = timelineComponent(ctx, (int)c, i) - timelineValue(base[i], offset[i]);
+                        int q = scale > 0.0f ? glm::clamp((int)std::lround(change / scale), -32767, 32767) : 0;
+                        quantized[i] = (int16_t)q;
+                        offset[i] += q * unit; // exactly what the player computes
+                    }
+                }
+            });
+        }
+
+        TimelineIndexEntry entry = { step, fileOffset, buffer.size(), keyframe ? (uint32_t)RECORD_KEYFRAME : (uint32_t)RECORD_DELTA, 0 };
+        index.push_back(entry);
+        tickets[current] = io.submitWrite(fileOffset, buffer.data(), buffer.size());
+        fileOffset += buffer.size();
+        current ^= 1;
+    }
+
+    bool close() {
+        if (!active) return true;
+        active = false;
+        for (int b = 0; b < 2; b++) {
+            if (tickets[b]) ok = io.wait(tickets[b]) && ok;
+            tickets[b] = 0;
+        }
+        header.recordCount = index.size();
+        header.indexOffset = fileOffset;
+        header.headerChecksum = timelineChecksum(header, index);
+        if (!index.empty()) {
+            ok = ok && io.wait(io.submitWrite(fileOffset, index.data(), index.size() * sizeof(TimelineIndexEntry)));
+        }
+        ok = ok && io.wait(io.submitWrite(0, &header, sizeof(header)));
+        ok = io.close() && ok;
+        if (!ok) std::cerr << "Failed writing timeline" << std::endl;
+        else std::cout << "Recorded " << index.size() << " timeline steps" << std::endl;
+        return ok;
+    }
+};
+
+struct TimelinePlayer {
+    MappedFile file;
+    bool active = false;
+    TimelineHeader header;
+    std::vector<TimelineIndexEntry> index;
+    std::vector<int64_t> offsets; // column-major, from keyframeRecord as of currentRecord
+    int64_t keyframeRecord = -1;
+    int64_t currentRecord = -1;
+
+    bool open(SimulationContext& ctx, const std::string& path) {
+        if (!file.open(path) || file.size < sizeof(TimelineHeader)) {
+            std::cerr << "Cannot open timeline " << path << std::endl;
+            return false;
+        }
+        memcpy(&header, file.data, sizeof(header));
+        if (memcmp(header.magic, TIMELINE_MAGIC, sizeof(header.magic)) != 0 || header.version != TIMELINE_VERSION ||
+            header.recordCount == 0 || header.indexOffset > file.size ||
+            header.recordCount > (file.size - header.indexOffset) / sizeof(TimelineIndexEntry)) {
+            std::cerr << path << " is not a complete timeline" << std::endl;
+            return false;
+        }
+        index.resize((size_t)header.recordCount);
+        memcpy(index.data(), file.data + header.indexOffset, index.size() * sizeof(TimelineIndexEntry));
+        if (timelineChecksum(header, index) != header.headerChecksum) {
+            std::cerr << "Timeline " << path << " has a corrupt index" << std::endl;
+            return false;
+        }
+
+        size_t starCount = (size_t)header.starCount;
+        for (size_t r = 0; r < index.size(); r++) {
+            const TimelineIndexEntry& entry = index[r];
+            uint64_t expected = entry.type == RECORD_KEYFRAME ? TIMELINE_COLUMNS * starCount * sizeof(float)
+                : TIMELINE_COLUMNS * timelineDeltaColumnBytes(starCount);
+            if (entry.bytes != expected || entry.offset > file.size || entry.bytes > file.size - entry.offset ||
+                entry.step != index[0].step + r || (r == 0 && entry.type != RECORD_KEYFRAME)) {
+                std::cerr << "Timeline " << path << " has an invalid record " << r << std::endl;
+                return false;
+            }
+        }
+
+        float baseColor[3];
+        wavelengthToRGB(0.5f, baseColor);
+        for (int model = 0; model < MODEL_COUNT; model++) {
+            starsForModel(ctx, model).assign(starCount, Star());
+            for (auto& star : starsForModel(ctx, model)) {
+                star.color = glm::vec3(baseColor[0], baseColor[1], baseColor[2]);
+            }
+        }
+        offsets.resize(TIMELINE_COLUMNS * starCount);
+        keyframeRecord = -1;
+        currentRecord = -1;
+        active = true;
+        return true;
+    }
+
+    uint64_t firstStep() const { return index.front().step; }
+    uint64_t lastStep() const { return index.back().step; }
+
+    // Add the changes of delta record r to the offsets, or undo them
+    void applyDelta(const SimulationContext& ctx, int64_t r, bool undo) {
+        size_t starCount = (size_t)header.starCount;
+        size_t columnBytes = timelineDeltaColumnBytes(starCount);
+        const unsigned char* record = file.data + index[(size_t)r].offset;
+        parallelFor(ctx.threads, starCount, [&](size_t begin, size_t end, unsigned int) {
+            for (int c = 0; c < TIMELINE_COLUMNS; c++) {
+                const unsigned char* column = record + c * columnBytes;
+                float scale;
+                memcpy(&scale, column, sizeof(scale));
+                int64_t unit = undo ? -timelineDeltaUnit(scale) : timelineDeltaUnit(scale);
+                const int16_t* quantized = reinterpret_cast<const int16_t*>(column + sizeof(float));
+                int64_t* values = &offsets[c * starCount];
+                for (size_t i = begin; i < end; i++) {
+                    values[i] += quantized[i] * unit;
+                }
+            }
+        });
+    }
+
+    // Bring the star arrays to the given step
+    void seek(SimulationContext& ctx, int64_t step) {
+        if (!active) return;
+        int64_t target = std::min<int64_t>(std::max<int64_t>(step - (int64_t)firstStep(), 0), (int64_t)index.size() - 1);
+        int64_t keyframe = target;
+        while (index[(size_t)keyframe].type != RECORD_KEYFRAME) keyframe--;
+
+        if (keyframeRecord == keyframe && currentRecord > target && currentRecord - target <= target - keyframe) {
+            // Undo back to an earlier step of the same keyframe interval
+            for (int64_t r = currentRecord; r > target; r--) {
+                applyDelta(ctx, r, true);
+            }
+        }
+        else {
+            int64_t from = currentRecord;
+            if (keyframeRecord != keyframe || currentRecord > target) {
+                std::fill(offsets.begin(), offsets.end(), 0);
+                keyframeRecord = keyframe;
+                from = keyframe;
+            }
+            for (int64_t r = from + 1; r <= target; r++) {
+                applyDelta(ctx, r, false);
+            }
+        }
+        currentRecord = target;
+
+        size_t starCount = (size_t)header.starCount;
+        const float* keyframeData = reinterpret_cast<const float*>(file.data + index[(size_t)keyframe].offset);
+        parallelFor(ctx.threads, starCount, [&](size_t begin, size_t end, unsigned int) {
+            for (int c = 0; c < TIMELINE_COLUMNS; c++) {
+                for (size_t i = begin; i < end; i++) {
+                    timelineComponent(ctx, c, i) = timelineValue(keyframeData[c * starCount + i], offsets[c * starCount + i]);
+                }
+            }
+        });
+        ctx.simulationStep = index[(size_t)target].step;
+        updateDopplerShifts(ctx);
+    }
+};
+
+SimulationContext::~SimulationContext() {}
+
+void recordTimelineStep(SimulationContext& ctx) {
+    if (ctx.recorder) ctx.recorder->append(ctx, ctx.simulationStep);
+}
+
+// Finish the context's timeline recording, if any
+bool closeTimelineRecording(SimulationContext& ctx) {
+    bool ok = !ctx.recorder || ctx.recorder->close();
+    ctx.recorder.reset();
+    return ok;
+}
+
+// Step the timeline player forwards or backwards
+void scrubTimeline(SimulationContext& ctx, int64_t steps) {
+    if (!ctx.player) return;
+    int64_t step = (int64_t)ctx.simulationStep + steps;
+    step = std::max<int64_t>(step, (int64_t)ctx.player->firstStep());
+    step = std::min<int64_t>(step, (int64_t)ctx.player->lastStep());
+    ctx.player->seek(ctx, step);
+}
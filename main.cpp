@@ -5,7 +5,39 @@
 
 
 #define _CRT_SECURE_NO_WARNINGS
-
+#define NOMINMAX
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define RDE_HAVE_IO_URING
+#endif
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#define RDE_HAVE_PERF_EVENTS
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RDE_HAVE_SSE2
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define RDE_HAVE_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define RDE_HAVE_RDTSC
+#endif
 
 #include <GL/glew.h>
 #pragma comment(lib, "glew32")
@@ -19,6 +51,28 @@
 #include <cmath>
 #include <random>
 #include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <charconv>
+#include <thread>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <atomic>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <limits>
+#include <array>
+#include <complex>
 
 // Constants
 const int NUM_STARS = 100000;
@@ -31,10 +85,6 @@ const float OBSERVER_POSITION_Z = 20.0f;
 // Display settings
 int windowWidth = 1200;
 int windowHeight = 600;
-bool showKeplerian = true;
-bool showFlatRotation = true;
-float viewAngle = 0.0f;
-float observerVelocity = 0.0f; // Observer's velocity as fraction of c
 
 // Star data structures
 struct Star {
@@ -44,12 +94,49 @@ struct Star {
     float dopplerShiftedColor[3];
 };
 
-std::vector<Star> keplerianStars;
-std::vector<Star> flatRotationStars;
-
 // Random number generator
 std::random_device rd;
-std::mt19937 gen(rd());
+
+struct TimelineRecorder;
+struct TimelinePlayer;
+
+// Simulation state
+// Everything one simulation mutates: both star catalogs, its random generator
+// and seed, the observer and view settings, the evolution clock and time step,
+// the worker count of its parallel loops, its outstanding checkpoint and its
+// timeline. Constants, options and lookup tables stay global and are only
+// read, so independent contexts can be generated, evolved and restored on
+// separate threads. The interactive viewer and the command line work on the
+// global `simulation`.
+struct SimulationContext {
+    std::vector<Star> keplerianStars;
+    std::vector<Star> flatRotationStars;
+    std::mt19937 gen;
+    unsigned int seed = rd();
+    bool seedFixed = false; // set when the seed comes from the command line
+    float observerVelocity = 0.0f; // Observer's velocity as fraction of c
+    float viewAngle = 0.0f;
+    bool showKeplerian = true;
+    bool showFlatRotation = true;
+    bool evolving = false;
+    float timeStep = 0.01f;
+    double simulationTime = 0.0;
+    uint64_t simulationStep = 0;
+    unsigned int threads = 0; // workers for this simulation's parallel loops, 0 = --threads
+    std::vector<Star> spareKeplerianStars; // integrated into while a checkpoint reads the arrays
+    std::vector<Star> spareFlatRotationStars;
+    std::future<bool> pendingCheckpoint; // declared after the arrays it reads, so it is destroyed first
+    bool checkpointReadsStars = false;
+    std::unique_ptr<TimelineRecorder> recorder; // while recording
+    std::unique_ptr<TimelinePlayer> player;     // while scrubbing a recorded timeline
+
+    SimulationContext() {}
+    SimulationContext(const SimulationContext&) = delete;
+    SimulationContext& operator=(const SimulationContext&) = delete;
+    ~SimulationContext(); // after the timeline types are complete
+};
+
+SimulationContext simulation;
 
 const double M_PI = 4.0 * atan(1.0);
 
@@ -57,6 +144,12 @@ std::uniform_real_distribution<float> angleDistribution(0.0f, 2.0f * M_PI);
 std::uniform_real_distribution<float> radiusDistribution(0.1f, GALAXY_RADIUS);
 std::uniform_real_distribution<float> heightDistribution(-0.5f, 0.5f);
 
+// The subsystems below are parts of this translation unit rather than separate
+// libraries: each builds on the sections before it, so they are included in order
+// and the program still compiles as the single file main.cpp.
+#include "profiler.h"
+#include "workers.h"
+
 // Function to convert wavelength to RGB color
 void wavelengthToRGB(float wavelength, float rgb[3]) {
     // Simplified visible spectrum approximation (400nm to 700nm)
@@ -94,12 +187,60 @@ void wavelengthToRGB(float wavelength, float rgb[3]) {
     }
 }
 
-// Calculate relativistic Doppler shift
-float calculateRelativisticDopplerShift(const glm::vec3& starVelocity, const glm::vec3& observerVelocity) {
-    // Calculate relative velocity along the line of sight
+// wavelengthToRGB() over an array, four wavelengths at a time with SSE2. Every
+// segment is evaluated and the one the branches above would take is selected,
+// with the same arithmetic, so the colours are identical.
+void wavelengthsToRGB(const float* wavelengths, float* rgb, size_t count) {
+    size_t i = 0;
+#ifdef RDE_HAVE_SSE2
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+    const __m128 segmentWidth = _mm_set1_ps(0.15f);
+    auto select = [](__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); };
+    for (; i + 4 <= count; i += 4) {
+        __m128 w = _mm_loadu_ps(wavelengths + i);
+        // Red, then each shorter segment overrides it where it applies
+        __m128 r = one, g = zero, b = zero;
+        __m128 mask = _mm_cmple_ps(w, _mm_set1_ps(0.75f)); // Yellow to red
+        g = select(mask, _mm_sub_ps(one, _mm_div_ps(_mm_sub_ps(w, _mm_set1_ps(0.6f)), segmentWidth)), g);
+        mask = _mm_cmple_ps(w, _mm_set1_ps(0.6f)); // Green to yellow
+        r = select(mask, _mm_div_ps(_mm_sub_ps(w, _mm_set1_ps(0.55f)), _mm_set1_ps(0.05f)), r);
+        g = select(mask, one, g);
+        mask = _mm_cmple_ps(w, _mm_set1_ps(0.55f)); // Cyan to green
+        r = select(mask, zero, r);
+        b = select(mask, _mm_sub_ps(one, _mm_div_ps(_mm_sub_ps(w, _mm_set1_ps(0.4f)), segmentWidth)), b);
+        mask = _mm_cmple_ps(w, _mm_set1_ps(0.4f)); // Blue to cyan
+        g = select(mask, _mm_div_ps(_mm_sub_ps(w, _mm_set1_ps(0.25f)), segmentWidth), g);
+        b = select(mask, one, b);
+        mask = _mm_cmple_ps(w, _mm_set1_ps(0.25f)); // Violet to blue
+        __m128 fraction = _mm_div_ps(w, _mm_set1_ps(0.25f));
+        r = select(mask, _mm_mul_ps(half, fraction), r);
+        g = select(mask, zero, g);
+        b = select(mask, _mm_add_ps(half, _mm_mul_ps(half, fraction)), b);
+
+        alignas(16) float lanes[3][4];
+        _mm_store_ps(lanes[0], r);
+        _mm_store_ps(lanes[1], g);
+        _mm_store_ps(lanes[2], b);
+        for (int k = 0; k < 4; k++) {
+            rgb[(i + k) * 3 + 0] = lanes[0][k];
+            rgb[(i + k) * 3 + 1] = lanes[1][k];
+            rgb[(i + k) * 3 + 2] = lanes[2][k];
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        wavelengthToRGB(wavelengths[i], rgb + i * 3);
+    }
+}
+
+// Relative velocity of a star along the line of sight, positive when receding
+float lineOfSightVelocity(const glm::vec3& starVelocity, const glm::vec3& observerVelocity) {
     glm::vec3 lineOfSight = glm::normalize(glm::vec3(0.0f, 0.0f, OBSERVER_POSITION_Z) - starVelocity);
-    float relativeVelocity = glm::dot(starVelocity - observerVelocity, lineOfSight);
+    return glm::dot(starVelocity - observerVelocity, lineOfSight);
+}
 
+// Doppler factor for a relative line-of-sight velocity
+float relativisticDopplerFactor(float relativeVelocity) {
     // Relativistic Doppler shift formula: λ' = λ * sqrt((1 + v/c) / (1 - v/c))
     // For wavelength, redshift (moving away) gives larger wavelength, blueshift (moving toward) gives smaller wavelength
     float beta = relativeVelocity / SPEED_OF_LIGHT;
@@ -112,15 +253,28 @@ float calculateRelativisticDopplerShift(const glm::vec3& starVelocity, const glm
     return dopplerFactor;
 }
 
-// Initialize star positions and velocities
-void initializeStars() {
-    keplerianStars.clear();
-    flatRotationStars.clear();
+// Calculate relativistic Doppler shift
+float calculateRelativisticDopplerShift(const glm::vec3& starVelocity, const glm::vec3& observerVelocity) {
+    // Calculate relative velocity along the line of sight
+    float relativeVelocity = lineOfSightVelocity(starVelocity, observerVelocity);
+    return relativisticDopplerFactor(relativeVelocity);
+}
 
-    for (int i = 0; i < NUM_STARS; i++) {
-        float angle = angleDistribution(gen);
-        float radius = radiusDistribution(gen);
-        float height = heightDistribution(gen);
+// Generate both star catalogs, drawing from the given random generator
+void generateStars(std::mt19937& generator, float observerSpeed, std::vector<Star>& keplerian, std::vector<Star>& flat,
+    size_t count = NUM_STARS) {
+    PhaseTimer timer(PHASE_GENERATE);
+    keplerian.clear();
+    flat.clear();
+
+    // Copies of the distributions, so concurrent calls share no state
+    auto angles = angleDistribution;
+    auto radii = radiusDistribution;
+    auto heights = heightDistribution;
+    for (size_t i = 0; i < count; i++) {
+        float angle = angles(generator);
+        float radius = radii(generator);
+        float height = heights(generator);
 
         // Position (same for both models initially)
         glm::vec3 position(radius * cos(angle), height, radius * sin(angle));
@@ -143,13 +297,13 @@ void initializeStars() {
 
         // Calculate Doppler shift for Keplerian model
         float keplerianDopplerFactor = calculateRelativisticDopplerShift(keplerianStar.velocity,
-            glm::vec3(0.0f, 0.0f, observerVelocity));
+            glm::vec3(0.0f, 0.0f, observerSpeed));
         float shiftedWavelength = wavelength * keplerianDopplerFactor;
         // Clamp to visible spectrum
         shiftedWavelength = glm::clamp(shiftedWavelength, 0.0f, 1.0f);
         wavelengthToRGB(shiftedWavelength, keplerianStar.dopplerShiftedColor);
 
-        keplerianStars.push_back(keplerianStar);
+        keplerian.push_back(keplerianStar);
 
         // Create flat rotation curve star
         Star flatStar;
@@ -161,43 +315,148 @@ void initializeStars() {
 
         // Calculate Doppler shift for flat rotation model
         float flatDopplerFactor = calculateRelativisticDopplerShift(flatStar.velocity,
-            glm::vec3(0.0f, 0.0f, observerVelocity));
+            glm::vec3(0.0f, 0.0f, observerSpeed));
         shiftedWavelength = wavelength * flatDopplerFactor;
         // Clamp to visible spectrum
         shiftedWavelength = glm::clamp(shiftedWavelength, 0.0f, 1.0f);
         wavelengthToRGB(shiftedWavelength, flatStar.dopplerShiftedColor);
 
-        flatRotationStars.push_back(flatStar);
+        flat.push_back(flatStar);
     }
 }
 
+void releaseCheckpointStars(SimulationContext& ctx);
+
+// Initialize star positions and velocities
+void initializeStars(SimulationContext& ctx, unsigned int seed, size_t count = NUM_STARS) {
+    releaseCheckpointStars(ctx);
+    ctx.seed = seed;
+    ctx.gen.seed(seed);
+    generateStars(ctx.gen, ctx.observerVelocity, ctx.keplerianStars, ctx.flatRotationStars, count);
+}
+
+// Doppler-shifted colour of a star emitting at the middle of the visible spectrum
+float dopplerShiftedStarColor(const glm::vec3& starVelocity, const glm::vec3& observerVel, float rgb[3],
+    float* radialVelocity = nullptr) {
+    float relativeVelocity = lineOfSightVelocity(starVelocity, observerVel);
+    float dopplerFactor = relativisticDopplerFactor(relativeVelocity);
+    if (radialVelocity) *radialVelocity = relativeVelocity;
+    float baseWavelength = 0.5f; // Middle of visible spectrum
+    float shiftedWavelength = baseWavelength * dopplerFactor;
+    shiftedWavelength = glm::clamp(shiftedWavelength, 0.0f, 1.0f);
+    wavelengthToRGB(shiftedWavelength, rgb);
+    return dopplerFactor;
+}
+
 // Update Doppler shifts based on current view and observer velocity
-void updateDopplerShifts() {
-    glm::vec3 observerVel(0.0f, 0.0f, observerVelocity);
+void updateDopplerShifts(SimulationContext& ctx) {
+    PhaseTimer timer(PHASE_DOPPLER);
+    releaseCheckpointStars(ctx);
+    glm::vec3 observerVel(0.0f, 0.0f, ctx.observerVelocity);
 
-    for (auto& star : keplerianStars) {
-        float dopplerFactor = calculateRelativisticDopplerShift(star.velocity, observerVel);
-        float baseWavelength = 0.5f; // Middle of visible spectrum
-        float shiftedWavelength = baseWavelength * dopplerFactor;
-        shiftedWavelength = glm::clamp(shiftedWavelength, 0.0f, 1.0f);
-        wavelengthToRGB(shiftedWavelength, star.dopplerShiftedColor);
+    for (auto& star : ctx.keplerianStars) {
+        dopplerShiftedStarColor(star.velocity, observerVel, star.dopplerShiftedColor);
     }
 
-    for (auto& star : flatRotationStars) {
-        float dopplerFactor = calculateRelativisticDopplerShift(star.velocity, observerVel);
-        float baseWavelength = 0.5f; // Middle of visible spectrum
-        float shiftedWavelength = baseWavelength * dopplerFactor;
-        shiftedWavelength = glm::clamp(shiftedWavelength, 0.0f, 1.0f);
-        wavelengthToRGB(shiftedWavelength, star.dopplerShiftedColor);
+    for (auto& star : ctx.flatRotationStars) {
+        dopplerShiftedStarColor(star.velocity, observerVel, star.dopplerShiftedColor);
+    }
+}
+
+// The same update split across the worker threads
+void updateDopplerShiftsThreaded(SimulationContext& ctx) {
+    PhaseTimer timer(PHASE_DOPPLER);
+    glm::vec3 observerVel(0.0f, 0.0f, ctx.observerVelocity);
+    for (std::vector<Star>* modelStars : { &ctx.keplerianStars, &ctx.flatRotationStars }) {
+        parallelFor(ctx.threads, modelStars->size(), [&](size_t begin, size_t end, unsigned int) {
+            Star* stars = modelStars->data();
+            for (size_t i = begin; i < end; i++) {
+                dopplerShiftedStarColor(stars[i].velocity, observerVel, stars[i].dopplerShiftedColor);
+            }
+        });
+    }
+}
+
+#include "snapshot.h"
+#include "evolution.h"
+#include "catalog_io.h"
+#include "analysis.h"
+#include "streaming.h"
+#include "benchmark.h"
+#include "selfcheck.h"
+
+// Frame profiler overlay: p50/p95/p99 of every phase over the samples in the rings
+void drawProfilerOverlay(float top) {
+    std::vector<ProfileSample> samples;
+    collectProfileSamples(samples);
+    double percentiles[PHASE_COUNT][3];
+    size_t counts[PHASE_COUNT];
+    profilePercentiles(samples, percentiles, counts);
+
+    char line[128];
+    snprintf(line, sizeof(line), "Profiler, last %zu frames (ms p50 / p95 / p99) | 'P' to hide", counts[PHASE_FRAME]);
+    glRasterPos2f(10, top);
+    for (const char* c = line; *c != '\0'; c++) {
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *c);
+    }
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (counts[phase] == 0) continue;
+        top -= 16;
+        snprintf(line, sizeof(line), "%-8s %7.3f / %7.3f / %7.3f", PROFILE_PHASE_NAMES[phase], percentiles[phase][0],
+            percentiles[phase][1], percentiles[phase][2]);
+        glRasterPos2f(10, top);
+        for (const char* c = line; *c != '\0'; c++) {
+            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *c);
+        }
+    }
+
+    // Hardware counter rates of the viewer thread and the workers it joined, since the previous overlay
+    static PerfCounters counters;
+    static bool countersOpened = false;
+    static double previous[PERF_COUNTER_COUNT];
+    static uint64_t previousTime = 0;
+    if (!countersOpened) {
+        countersOpened = true;
+        counters.open();
+        counters.read(previous);
+        previousTime = profilerNanoseconds(std::chrono::steady_clock::now());
+    }
+    if (!counters.available()) return;
+    double current[PERF_COUNTER_COUNT];
+    counters.read(current);
+    uint64_t now = profilerNanoseconds(std::chrono::steady_clock::now());
+    double seconds = std::max((now - previousTime) / 1e9, 1e-9);
+    double rates[PERF_COUNTER_COUNT];
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        rates[c] = (current[c] - previous[c]) / seconds;
+        previous[c] = current[c];
+    }
+    previousTime = now;
+    top -= 16;
+    snprintf(line, sizeof(line), "hw/s: %.2f Gcycles, IPC %.2f, %.2f M cache misses, %.2f M branch misses", rates[PERF_CYCLES] / 1e9,
+        rates[PERF_INSTRUCTIONS] / rates[PERF_CYCLES], rates[PERF_CACHE_MISSES] / 1e6, rates[PERF_BRANCH_MISSES] / 1e6);
+    glRasterPos2f(10, top);
+    for (const char* c = line; *c != '\0'; c++) {
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *c);
     }
 }
 
 // Display function
 void display() {
+    // Frame time runs from one display() to the next, so it covers idle work and buffer swaps
+    static uint64_t lastFrameStart = 0;
+    uint64_t frameStart = profilerNanoseconds(std::chrono::steady_clock::now());
+    if (profilerEnabled.load(std::memory_order_relaxed) && lastFrameStart != 0) {
+        recordProfileSample(PHASE_FRAME, lastFrameStart, frameStart);
+    }
+    lastFrameStart = frameStart;
+    drainTrace();
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    PhaseTimer pointsTimer(PHASE_POINTS);
 
     // Left viewport - Keplerian model
-    if (showKeplerian) {
+    if (simulation.showKeplerian) {
         glViewport(0, 0, windowWidth / 2, windowHeight);
         glMatrixMode(GL_PROJECTION);
         glLoadIdentity();
@@ -209,12 +468,12 @@ void display() {
             0.0f, 0.0f, 0.0f,   // Look at position
             0.0f, 1.0f, 0.0f);  // Up vector
 
-      //  glRotatef(viewAngle, 0.0f, 1.0f, 0.0f);
+      //  glRotatef(simulation.viewAngle, 0.0f, 1.0f, 0.0f);
 
         // Draw Keplerian stars
         glPointSize(2.0f);
         glBegin(GL_POINTS);
-        for (const auto& star : keplerianStars) {
+        for (const auto& star : simulation.keplerianStars) {
             glColor3fv(star.dopplerShiftedColor);
             glVertex3fv(glm::value_ptr(star.position));
         }
@@ -230,7 +489,7 @@ void display() {
     }
 
     // Right viewport - Flat rotation curve model
-    if (showFlatRotation) {
+    if (simulation.showFlatRotation) {
         glViewport(windowWidth / 2, 0, windowWidth / 2, windowHeight);
         glMatrixMode(GL_PROJECTION);
         glLoadIdentity();
@@ -242,12 +501,12 @@ void display() {
             0.0f, 0.0f, 0.0f,   // Look at position
             0.0f, 1.0f, 0.0f);  // Up vector
 
-       // glRotatef(viewAngle, 0.0f, 1.0f, 0.0f);
+       // glRotatef(simulation.viewAngle, 0.0f, 1.0f, 0.0f);
 
         // Draw flat rotation curve stars
         glPointSize(2.0f);
         glBegin(GL_POINTS);
-        for (const auto& star : flatRotationStars) {
+        for (const auto& star : simulation.flatRotationStars) {
             glColor3fv(star.dopplerShiftedColor);
             glVertex3fv(glm::value_ptr(star.position));
         }
@@ -262,7 +521,10 @@ void display() {
         }
     }
 
+    pointsTimer.stop();
+
     // Draw information about observer velocity and controls
+    PhaseTimer hudTimer(PHASE_HUD);
     glViewport(0, 0, windowWidth, windowHeight);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
@@ -276,12 +538,32 @@ void display() {
 
     char velocityInfo[100];
     sprintf(velocityInfo, "Observer Velocity: %.2fc | View Angle: %.1f | Use 'W/S' for velocity, 'A/D' for rotation",
-        observerVelocity, viewAngle);
+        simulation.observerVelocity, simulation.viewAngle);
 
     for (const char* c = velocityInfo; *c != '\0'; c++) {
         glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *c);
     }
 
+    if (simulation.player || simulation.evolving) {
+        char timelineInfo[100];
+        if (simulation.player) {
+            sprintf(timelineInfo, "Timeline step %llu of %llu-%llu | ',/.' and '[/]' to scrub",
+                (unsigned long long)simulation.simulationStep, (unsigned long long)simulation.player->firstStep(),
+                (unsigned long long)simulation.player->lastStep());
+        }
+        else {
+            sprintf(timelineInfo, "Evolving: step %llu, time %.2f", (unsigned long long)simulation.simulationStep, simulation.simulationTime);
+        }
+        glRasterPos2f(10, windowHeight - 40);
+        for (const char* c = timelineInfo; *c != '\0'; c++) {
+            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *c);
+        }
+    }
+
+    if (profilerOverlayShown) {
+        drawProfilerOverlay(windowHeight - 60.0f);
+    }
+
     // Draw Doppler explanation and color scale
     glRasterPos2f(10, 20);
     const char* dopplerInfo = "Redshift = Moving Away (Redder) | Blueshift = Moving Toward (Bluer)";
@@ -324,6 +606,8 @@ void display() {
     //    glutBitmapCharacter(GLUT_BITMAP_HELVETICA_10, *c);
     //}
 
+    hudTimer.stop();
+    PhaseTimer swapTimer(PHASE_SWAP);
     glutSwapBuffers();
 }
 
@@ -331,36 +615,57 @@ void display() {
 void keyboard(unsigned char key, int x, int y) {
     switch (key) {
     case 'w': case 'W':
-        observerVelocity += 0.01f;
-        if (observerVelocity > 0.9f) observerVelocity = 0.9f;
-        updateDopplerShifts();
+        simulation.observerVelocity += 0.01f;
+        if (simulation.observerVelocity > 0.9f) simulation.observerVelocity = 0.9f;
+        updateDopplerShifts(simulation);
         break;
     case 's': case 'S':
-        observerVelocity -= 0.01f;
-        if (observerVelocity < -0.9f) observerVelocity = -0.9f;
-        updateDopplerShifts();
+        simulation.observerVelocity -= 0.01f;
+        if (simulation.observerVelocity < -0.9f) simulation.observerVelocity = -0.9f;
+        updateDopplerShifts(simulation);
         break;
     case 'a': case 'A':
-        viewAngle -= 5.0f;
+        simulation.viewAngle -= 5.0f;
         break;
     case 'd': case 'D':
-        viewAngle += 5.0f;
+        simulation.viewAngle += 5.0f;
         break;
     case 'k': case 'K':
-        showKeplerian = !showKeplerian;
+        simulation.showKeplerian = !simulation.showKeplerian;
         break;
     case 'f': case 'F':
-        showFlatRotation = !showFlatRotation;
+        simulation.showFlatRotation = !simulation.showFlatRotation;
+        break;
+    case 'p': case 'P':
+        profilerOverlayShown = !profilerOverlayShown;
+        profilerEnabled.store(profilerOverlayShown || !tracePath.empty());
+        break;
+    case 'e': case 'E':
+        simulation.evolving = !simulation.evolving && !simulation.player;
+        break;
+    case ',':
+        scrubTimeline(simulation, -1);
+        break;
+    case '.':
+        scrubTimeline(simulation, 1);
+        break;
+    case '[':
+        scrubTimeline(simulation, -10);
+        break;
+    case ']':
+        scrubTimeline(simulation, 10);
         break;
     case 'r': case 'R':
         // Reset
-        viewAngle = 0.0f;
-        observerVelocity = 0.0f;
-        showKeplerian = true;
-        showFlatRotation = true;
-        updateDopplerShifts();
+        simulation.viewAngle = 0.0f;
+        simulation.observerVelocity = 0.0f;
+        simulation.showKeplerian = true;
+        simulation.showFlatRotation = true;
+        updateDopplerShifts(simulation);
         break;
     case 27:  // ESC key
+        finishCheckpoints(simulation);
+        closeTimelineRecording(simulation);
         exit(0);
         break;
     }
@@ -378,14 +683,472 @@ void reshape(int w, int h) {
 // Idle function for continuous rotation
 void idle() {
     // Automatic slow rotation
-    viewAngle += 0.1f;
-    if (viewAngle > 360.0f) viewAngle -= 360.0f;
+    simulation.viewAngle += 0.1f;
+    if (simulation.viewAngle > 360.0f) simulation.viewAngle -= 360.0f;
+
+    if (simulation.evolving) {
+        advanceSimulation(simulation);
+    }
 
     glutPostRedisplay();
 }
 
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]" << std::endl;
+    std::cout << "  --load-snapshot FILE   Load the star catalog from a snapshot instead of generating it" << std::endl;
+    std::cout << "  --save-snapshot FILE   Save the star catalog to a snapshot and exit" << std::endl;
+    std::cout << "  --compress-tolerance T Save packed snapshot columns accurate to within T" << std::endl;
+    std::cout << "  --no-verify            Skip snapshot checksum verification when loading" << std::endl;
+    std::cout << "  --seed N               Generate stars from a fixed random seed" << std::endl;
+    std::cout << "  --cache-dir DIR        Cache generated catalogs in DIR (only used with --seed)" << std::endl;
+    std::cout << "  --cache-max-mb N       Evict least recently used catalogs above N megabytes" << std::endl;
+    std::cout << "  --cache-max-entries N  Keep at most N cached catalogs" << std::endl;
+    std::cout << "  --export FILE          Export per-star Doppler results as columnar binary and exit" << std::endl;
+    std::cout << "  --export-csv FILE      Export per-star Doppler results as CSV and exit" << std::endl;
+    std::cout << "  --export-velocities L  Comma-separated observer velocities to export (default: current)" << std::endl;
+    std::cout << "  --import-csv FILE      Import stars from a CSV catalog with x,y,z,vx,vy,vz columns" << std::endl;
+    std::cout << "  --import-position-scale S  Multiply imported positions by S" << std::endl;
+    std::cout << "  --import-velocity-scale S  Multiply imported velocities by S (velocities are fractions of c)" << std::endl;
+    std::cout << "  --stream-render FILE   Render a snapshot out of core to an image and exit" << std::endl;
+    std::cout << "  --render-output FILE   Image written by --stream-render (default render.ppm);" << std::endl;
+    std::cout << "                         a .fits name writes an RGB cube plus a _velocity map" << std::endl;
+    std::cout << "  --chunk-stars N        Stars per streamed chunk (default 4194304)" << std::endl;
+    std::cout << "  --stream-io MODE       How --stream-render reads chunks: mmap (default) or read" << std::endl;
+    std::cout << "  --moment-maps PREFIX   Write moment 0/1/2 maps of both models as PREFIX_<model>_mom<n>.fits" << std::endl;
+    std::cout << "                         (binned in the same pass with --stream-render)" << std::endl;
+    std::cout << "  --map-size N           Moment map width and height in pixels (default 512)" << std::endl;
+    std::cout << "  --cube FILE            Write (x, y, wavelength) cubes of both models as FILE_<model>.fits" << std::endl;
+    std::cout << "  --cube-size N          Cube width and height in pixels (default 128)" << std::endl;
+    std::cout << "  --cube-channels N      Cube wavelength channels (default 256)" << std::endl;
+    std::cout << "  --cube-wavelengths A,B Cube wavelength range in nm (default 300,1400)" << std::endl;
+    std::cout << "  --line-rest NM         Emission line rest wavelength (default 656.28)" << std::endl;
+    std::cout << "  --line-width NM        Emission line Gaussian sigma (default 4)" << std::endl;
+    std::cout << "  --line-list FILE       Lines as 'name rest_nm strength' rows (negative = absorption)," << std::endl;
+    std::cout << "                         or 'nebular' for H-beta, [OIII], [NII], H-alpha and [SII]" << std::endl;
+    std::cout << "  --cube-memory-mb N     Build cubes larger than N megabytes in wavelength slabs (default 512)" << std::endl;
+    std::cout << "  --pv-slit PA,WIDTH     Also write FILE_<model>_pv.fits through a slit at PA degrees" << std::endl;
+    std::cout << "  --profile FILE         Write galaxy-integrated line profiles (wavelength x observer x model)" << std::endl;
+    std::cout << "  --doppler-sweep FILE   Write per-observer Doppler factor statistics of both models as CSV" << std::endl;
+    std::cout << "  --profile-velocities L Observer velocities for --profile and --doppler-sweep:" << std::endl;
+    std::cout << "                         A,B,C or MIN:MAX:N (default: current)" << std::endl;
+    std::cout << "  --fit-rotation SRC     Fit a rotation curve by parallel-tempered MCMC to the moment-1 map of" << std::endl;
+    std::cout << "                         the keplerian or flat stars, or to a moment-1 FITS file" << std::endl;
+    std::cout << "  --fit-weights FILE     Moment-0 FITS map weighting the pixels of a moment-1 file" << std::endl;
+    std::cout << "  --fit-iterations N     Sampler iterations, the first half burn-in (default 4000)" << std::endl;
+    std::cout << "  --fit-temperatures N   Parallel-tempering temperatures (default 8)" << std::endl;
+    std::cout << "  --fit-max-temperature T Hottest temperature (default 50)" << std::endl;
+    std::cout << "  --fit-chain FILE       Write the cold chain after burn-in as CSV" << std::endl;
+    std::cout << "  --fit-scaling          Report likelihood evaluations/s across thread counts" << std::endl;
+    std::cout << "  --measure-redshifts N  Measure Doppler factors of N stars per model from synthetic spectra" << std::endl;
+    std::cout << "                         by FFT cross-correlation and compare them with the true factors" << std::endl;
+    std::cout << "  --redshift-pixels N    ln-wavelength pixels per spectrum (default 4096)" << std::endl;
+    std::cout << "  --redshift-noise S     Gaussian noise per pixel (default 0.02)" << std::endl;
+    std::cout << "  --redshift-output FILE Write true and measured factors as CSV" << std::endl;
+    std::cout << "  --ensemble N           Evaluate N realizations (seeds --seed to --seed + N - 1) and exit" << std::endl;
+    std::cout << "  --ensemble-output FILE Write the ensemble mean and scatter of every statistic as CSV" << std::endl;
+    std::cout << "  --bench FILE           Benchmark the per-star kernels and write the results as JSON" << std::endl;
+    std::cout << "  --bench-stars MIN:MAX  Star counts to benchmark, in decades (default 1000:10000000;" << std::endl;
+    std::cout << "                         1e8 stars needs about 10 GB of memory)" << std::endl;
+    std::cout << "  --scaling FILE         Sweep thread and star counts against STREAM bandwidth, print a roofline" << std::endl;
+    std::cout << "                         summary and write the results as CSV" << std::endl;
+    std::cout << "  --tully-fisher N       Measure line widths of N mock galaxies (seeds --seed onwards) and exit" << std::endl;
+    std::cout << "  --tf-stars N           Stars in a mock galaxy of the default mass (default 20000)" << std::endl;
+    std::cout << "  --tf-output FILE       Mock Tully-Fisher catalog CSV (default tully_fisher.csv)" << std::endl;
+    std::cout << "  --observer-velocity V  Initial observer velocity as a fraction of c" << std::endl;
+    std::cout << "  --evolve               Start with orbit evolution running" << std::endl;
+    std::cout << "  --evolve-steps N       Evolve headless until step N, then save (--save-snapshot) and exit" << std::endl;
+    std::cout << "  --time-step DT         Orbit evolution time step (default 0.01)" << std::endl;
+    std::cout << "  --checkpoint PREFIX    Write checkpoints to PREFIX_<step>.rdesnap" << std::endl;
+    std::cout << "  --checkpoint-every N   Checkpoint every N evolution steps" << std::endl;
+    std::cout << "  --restart FILE         Continue from a checkpoint" << std::endl;
+    std::cout << "  --record FILE          Record evolution steps to a timeline" << std::endl;
+    std::cout << "  --keyframe-every N     Full keyframe every N recorded steps (default 50)" << std::endl;
+    std::cout << "  --play FILE            Scrub through a recorded timeline instead of simulating" << std::endl;
+    std::cout << "  --seek N               With --play and --save-snapshot: save the state at step N and exit" << std::endl;
+    std::cout << "  --self-check           Run the built-in round-trip and equivalence checks and exit" << std::endl;
+    std::cout << "  --threads N            Number of worker threads (default: all hardware threads)" << std::endl;
+    std::cout << "  --frame-profiler       Start with the frame profiler overlay shown (toggle with 'P')" << std::endl;
+    std::cout << "  --trace FILE           Record phase timings of the whole run as Chrome trace JSON, written at exit" << std::endl;
+}
+
+bool parseCommandLine(int argc, char** argv) {
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--load-snapshot" && hasValue) {
+                loadSnapshotPath = argv[++i];
+            }
+            else if (arg == "--save-snapshot" && hasValue) {
+                saveSnapshotPath = argv[++i];
+            }
+            else if (arg == "--compress-tolerance" && hasValue) {
+                snapshotCompressionTolerance = std::stof(argv[++i]);
+            }
+            else if (arg == "--no-verify") {
+                verifySnapshotChecksums = false;
+            }
+            else if (arg == "--seed" && hasValue) {
+                simulation.seed = (unsigned int)std::stoul(argv[++i]);
+                simulation.seedFixed = true;
+            }
+            else if (arg == "--cache-dir" && hasValue) {
+                cacheDirectory = argv[++i];
+            }
+            else if (arg == "--cache-max-mb" && hasValue) {
+                cacheMaxBytes = std::stoull(argv[++i]) << 20;
+            }
+            else if (arg == "--cache-max-entries" && hasValue) {
+                cacheMaxEntries = std::stoi(argv[++i]);
+            }
+            else if (arg == "--export" && hasValue) {
+                exportPath = argv[++i];
+            }
+            else if (arg == "--export-csv" && hasValue) {
+                exportCsvPath = argv[++i];
+            }
+            else if (arg == "--export-velocities" && hasValue) {
+                exportObserverVelocities = parseFloatList(argv[++i]);
+            }
+            else if (arg == "--import-csv" && hasValue) {
+                importCsvPath = argv[++i];
+            }
+            else if (arg == "--import-position-scale" && hasValue) {
+                importPositionScale = std::stof(argv[++i]);
+            }
+            else if (arg == "--import-velocity-scale" && hasValue) {
+                importVelocityScale = std::stof(argv[++i]);
+            }
+            else if (arg == "--stream-render" && hasValue) {
+                streamRenderPath = argv[++i];
+            }
+            else if (arg == "--render-output" && hasValue) {
+                renderOutputPath = argv[++i];
+            }
+            else if (arg == "--chunk-stars" && hasValue) {
+                streamChunkStars = (size_t)std::stoull(argv[++i]);
+            }
+            else if (arg == "--stream-io" && hasValue) {
+                std::string mode = argv[++i];
+                if (mode != "mmap" && mode != "read") throw std::invalid_argument(mode);
+                streamWithReads = mode == "read";
+            }
+            else if (arg == "--moment-maps" && hasValue) {
+                momentMapPrefix = argv[++i];
+            }
+            else if (arg == "--map-size" && hasValue) {
+                momentMapSize = std::stoi(argv[++i]);
+                if (momentMapSize <= 0) throw std::invalid_argument("map size");
+            }
+            else if (arg == "--cube" && hasValue) {
+                cubePath = argv[++i];
+            }
+            else if (arg == "--cube-size" && hasValue) {
+                cubeSize = std::stoi(argv[++i]);
+                if (cubeSize <= 0) throw std::invalid_argument("cube size");
+            }
+            else if (arg == "--cube-channels" && hasValue) {
+                cubeChannels = std::stoi(argv[++i]);
+                if (cubeChannels <= 0) throw std::invalid_argument("cube channels");
+            }
+            else if (arg == "--cube-wavelengths" && hasValue) {
+                std::vector<float> range = parseFloatList(argv[++i]);
+                if (range.size() != 2 || !(range[0] < range[1])) throw std::invalid_argument("wavelength range");
+                cubeWavelengthMin = range[0];
+                cubeWavelengthMax = range[1];
+            }
+            else if (arg == "--line-rest" && hasValue) {
+                cubeRestWavelength = std::stof(argv[++i]);
+            }
+            else if (arg == "--line-list" && hasValue) {
+                if (!loadLineList(argv[++i])) return false;
+            }
+            else if (arg == "--line-width" && hasValue) {
+                cubeLineWidth = std::stof(argv[++i]);
+                if (!(cubeLineWidth > 0.0f)) throw std::invalid_argument("line width");
+            }
+            else if (arg == "--cube-memory-mb" && hasValue) {
+                cubeMemoryBytes = std::stoull(argv[++i]) << 20;
+            }
+            else if (arg == "--pv-slit" && hasValue) {
+                std::vector<float> slit = parseFloatList(argv[++i]);
+                if (slit.size() != 2 || !(slit[1] > 0.0f)) throw std::invalid_argument("slit");
+                pvSlit = true;
+                slitAngle = slit[0];
+                slitWidth = slit[1];
+            }
+            else if (arg == "--profile" && hasValue) {
+                profilePath = argv[++i];
+            }
+            else if (arg == "--doppler-sweep" && hasValue) {
+                dopplerSweepPath = argv[++i];
+            }
+            else if (arg == "--profile-velocities" && hasValue) {
+                profileObserverVelocities = parseVelocitySweep(argv[++i]);
+            }
+            else if (arg == "--fit-rotation" && hasValue) {
+                fitSource = argv[++i];
+            }
+            else if (arg == "--fit-weights" && hasValue) {
+                fitWeightsPath = argv[++i];
+            }
+            else if (arg == "--fit-iterations" && hasValue) {
+                fitIterations = std::stoi(argv[++i]);
+                if (fitIterations <= 0) throw std::invalid_argument("iterations");
+            }
+            else if (arg == "--fit-temperatures" && hasValue) {
+                fitTemperatures = std::stoi(argv[++i]);
+                if (fitTemperatures <= 0) throw std::invalid_argument("temperatures");
+            }
+            else if (arg == "--fit-max-temperature" && hasValue) {
+                fitMaxTemperature = std::stof(argv[++i]);
+                if (!(fitMaxTemperature >= 1.0f)) throw std::invalid_argument("temperature");
+            }
+            else if (arg == "--fit-chain" && hasValue) {
+                fitChainPath = argv[++i];
+            }
+            else if (arg == "--fit-scaling") {
+                fitScaling = true;
+            }
+            else if (arg == "--measure-redshifts" && hasValue) {
+                redshiftSpectra = std::stoi(argv[++i]);
+                if (redshiftSpectra <= 0) throw std::invalid_argument("spectra");
+            }
+            else if (arg == "--redshift-pixels" && hasValue) {
+                redshiftPixels = std::stoi(argv[++i]);
+                if (redshiftPixels < 16) throw std::invalid_argument("pixels");
+            }
+            else if (arg == "--redshift-noise" && hasValue) {
+                redshiftNoise = std::stof(argv[++i]);
+                if (!(redshiftNoise >= 0.0f)) throw std::invalid_argument("noise");
+            }
+            else if (arg == "--redshift-output" && hasValue) {
+                redshiftOutputPath = argv[++i];
+            }
+            else if (arg == "--ensemble" && hasValue) {
+                ensembleRealizations = std::stoi(argv[++i]);
+                if (ensembleRealizations <= 0) throw std::invalid_argument("realizations");
+            }
+            else if (arg == "--ensemble-output" && hasValue) {
+                ensembleOutputPath = argv[++i];
+            }
+            else if (arg == "--bench" && hasValue) {
+                benchPath = argv[++i];
+            }
+            else if (arg == "--scaling" && hasValue) {
+                scalingPath = argv[++i];
+            }
+            else if (arg == "--bench-stars" && hasValue) {
+                std::string range = argv[++i];
+                size_t colon = range.find(':');
+                if (colon == std::string::npos) throw std::invalid_argument(range);
+                benchMinStars = std::stoull(range.substr(0, colon));
+                benchMaxStars = std::stoull(range.substr(colon + 1));
+                if (benchMinStars == 0 || benchMaxStars < benchMinStars) throw std::invalid_argument(range);
+            }
+            else if (arg == "--tully-fisher" && hasValue) {
+                tullyFisherGalaxies = std::stoi(argv[++i]);
+                if (tullyFisherGalaxies <= 0) throw std::invalid_argument("galaxies");
+            }
+            else if (arg == "--tf-stars" && hasValue) {
+                tullyFisherStars = std::stoull(argv[++i]);
+            }
+            else if (arg == "--tf-output" && hasValue) {
+                tullyFisherOutputPath = argv[++i];
+            }
+            else if (arg == "--observer-velocity" && hasValue) {
+                simulation.observerVelocity = glm::clamp(std::stof(argv[++i]), -0.9f, 0.9f);
+            }
+            else if (arg == "--evolve") {
+                simulation.evolving = true;
+            }
+            else if (arg == "--evolve-steps" && hasValue) {
+                evolveUntilStep = std::stoull(argv[++i]);
+            }
+            else if (arg == "--time-step" && hasValue) {
+                simulation.timeStep = std::stof(argv[++i]);
+            }
+            else if (arg == "--checkpoint" && hasValue) {
+                checkpointPrefix = argv[++i];
+            }
+            else if (arg == "--checkpoint-every" && hasValue) {
+                checkpointInterval = std::stoull(argv[++i]);
+            }
+            else if (arg == "--restart" && hasValue) {
+                restartPath = argv[++i];
+            }
+            else if (arg == "--record" && hasValue) {
+                recordPath = argv[++i];
+            }
+            else if (arg == "--keyframe-every" && hasValue) {
+                keyframeInterval = (uint32_t)std::stoul(argv[++i]);
+            }
+            else if (arg == "--play" && hasValue) {
+                playPath = argv[++i];
+            }
+            else if (arg == "--seek" && hasValue) {
+                playSeekStep = std::stoll(argv[++i]);
+            }
+            else if (arg == "--self-check") {
+                selfCheck = true;
+            }
+            else if (arg == "--threads" && hasValue) {
+                workerThreads = (unsigned int)std::stoul(argv[++i]);
+            }
+            else if (arg == "--frame-profiler") {
+                profilerOverlayShown = true;
+                profilerEnabled.store(true);
+            }
+            else if (arg == "--trace" && hasValue) {
+                tracePath = argv[++i];
+                profilerEnabled.store(true);
+            }
+            else if (arg.compare(0, 2, "--") == 0) {
+                printUsage(argv[0]);
+                return false;
+            }
+        }
+    }
+    catch (const std::exception&) {
+        // Malformed numeric argument
+        printUsage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
 // Main function
 int main(int argc, char** argv) {
+    if (!parseCommandLine(argc, argv)) {
+        return 1;
+    }
+
+    // The trace is written however the run ends, including exit() from the keyboard handler
+    if (!tracePath.empty()) {
+        threadProfileRing(); // the main thread gets the first track
+        std::atexit(writeTraceAtExit);
+    }
+
+    if (selfCheck) {
+        return runSelfCheck() ? 0 : 1;
+    }
+    if (!benchPath.empty()) {
+        return runBenchmarks(simulation) ? 0 : 1;
+    }
+    if (!scalingPath.empty()) {
+        return runScalingBenchmark(simulation) ? 0 : 1;
+    }
+    if (!streamRenderPath.empty()) {
+        return runStreamRender(simulation) ? 0 : 1;
+    }
+    if (ensembleRealizations > 0) {
+        return runEnsemble(simulation) ? 0 : 1;
+    }
+    if (tullyFisherGalaxies > 0) {
+        return runTullyFisher(simulation) ? 0 : 1;
+    }
+
+    // Initialize stars
+    if (!playPath.empty()) {
+        simulation.player.reset(new TimelinePlayer);
+        if (!simulation.player->open(simulation, playPath)) {
+            return 1;
+        }
+        simulation.evolving = false;
+        simulation.player->seek(simulation, playSeekStep >= 0 ? playSeekStep : (int64_t)simulation.player->firstStep());
+    }
+    else if (!restartPath.empty()) {
+        if (!restartFromCheckpoint(simulation, restartPath)) {
+            return 1;
+        }
+    }
+    else if (!importCsvPath.empty()) {
+        if (!importCatalogCSV(simulation, importCsvPath)) {
+            return 1;
+        }
+    }
+    else if (!loadSnapshotPath.empty()) {
+        if (!loadSnapshot(simulation, loadSnapshotPath, verifySnapshotChecksums)) {
+            return 1;
+        }
+    }
+    else {
+        initializeStarsCached(simulation);
+    }
+
+    if (!recordPath.empty() && !simulation.player) {
+        simulation.recorder.reset(new TimelineRecorder);
+        if (!simulation.recorder->open(simulation, recordPath)) {
+            return 1;
+        }
+        simulation.recorder->append(simulation, simulation.simulationStep);
+    }
+
+    if (evolveUntilStep > 0) {
+        while (simulation.simulationStep < evolveUntilStep) {
+            advanceSimulation(simulation);
+            drainTrace();
+        }
+        bool ok = finishCheckpoints(simulation) && closeTimelineRecording(simulation);
+        std::cout << "Evolved to step " << simulation.simulationStep << ", time " << simulation.simulationTime << std::endl;
+        if (!ok || (!saveSnapshotPath.empty() && !saveSnapshot(simulation, saveSnapshotPath))) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // Headless products, optionally followed by --save-snapshot
+    bool headless = false;
+    if (!exportPath.empty() || !exportCsvPath.empty()) {
+        if (!exportDopplerResults(simulation)) {
+            return 1;
+        }
+        headless = true;
+    }
+    if (!momentMapPrefix.empty()) {
+        if (!writeMomentMapsOfStars(simulation)) {
+            return 1;
+        }
+        headless = true;
+    }
+    if (!cubePath.empty()) {
+        if (!writeSpectralCubes(simulation)) {
+            return 1;
+        }
+        headless = true;
+    }
+    if (!profilePath.empty()) {
+        if (!writeIntegratedProfiles(simulation)) {
+            return 1;
+        }
+        headless = true;
+    }
+    if (!dopplerSweepPath.empty()) {
+        if (!writeDopplerSweep(simulation)) {
+            return 1;
+        }
+        headless = true;
+    }
+    if (!fitSource.empty()) {
+        if (!runRotationFit(simulation)) {
+            return 1;
+        }
+        headless = true;
+    }
+    if (redshiftSpectra > 0) {
+        if (!measureRedshifts(simulation)) {
+            return 1;
+        }
+        headless = true;
+    }
+
+    if (!saveSnapshotPath.empty()) {
+        return saveSnapshot(simulation, saveSnapshotPath) ? 0 : 1;
+    }
+    if (headless) {
+        return 0;
+    }
+
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitWindowSize(windowWidth, windowHeight);
@@ -396,9 +1159,6 @@ int main(int argc, char** argv) {
     glEnable(GL_POINT_SMOOTH);
     glHint(GL_POINT_SMOOTH_HINT, GL_NICEST);
 
-    // Initialize stars
-    initializeStars();
-
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
@@ -409,6 +1169,8 @@ int main(int argc, char** argv) {
     std::cout << "  A/D: Rotate view left/right" << std::endl;
     std::cout << "  K: Toggle Keplerian model display" << std::endl;
     std::cout << "  F: Toggle Flat rotation model display" << std::endl;
+    std::cout << "  E: Toggle orbit evolution" << std::endl;
+    std::cout << "  ,/.: Step a played timeline back/forward, [/]: by 10 steps" << std::endl;
     std::cout << "  R: Reset view and settings" << std::endl;
     std::cout << "  ESC: Exit" << std::endl;
 
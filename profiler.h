@@ -0,0 +1,225 @@
+#pragma once
+// Frame profiler: per-thread timing rings, phase timers and the Chrome trace export
+
+// Frame profiler
+// PhaseTimer objects time a scope and append a sample to the calling thread's
+// ring of the last PROFILE_RING_SIZE samples. Only the owning thread writes a
+// ring and publishes each sample by advancing its count with a release store,
+// so recording takes no locks; a ring is claimed from the registry once per
+// thread and handed back for reuse when the thread exits. Readers copy a ring
+// and drop samples the owner may have overwritten meanwhile. Timers record
+// while the overlay is shown or a trace is being captured; otherwise a timer
+// costs one relaxed load.
+enum ProfilePhase {
+    PHASE_FRAME,    // display() to display()
+    PHASE_DOPPLER,  // updateDopplerShifts()
+    PHASE_EVOLVE,   // advanceSimulation(), including its Doppler update
+    PHASE_POINTS,   // submitting both models' points
+    PHASE_HUD,      // overlay text
+    PHASE_SWAP,     // glutSwapBuffers()
+    PHASE_GENERATE, // generateStars()
+    PHASE_TASK,     // one worker's share of a parallelFor() or one workStealingFor() task
+    PHASE_IO_WAIT,  // blocked in AsyncFileIO::wait()
+    PHASE_SNAPSHOT, // writing or loading a snapshot
+    PHASE_COUNT
+};
+
+const char* const PROFILE_PHASE_NAMES[PHASE_COUNT] = { "frame", "doppler", "evolve", "points", "hud", "swap", "generate",
+    "task", "io wait", "snapshot" };
+const char* const PROFILE_PHASE_CATEGORIES[PHASE_COUNT] = { "render", "simulation", "simulation", "render", "render", "render",
+    "simulation", "workers", "io", "io" };
+const size_t PROFILE_RING_SIZE = 1024; // power of two
+
+std::atomic<bool> profilerEnabled(false);
+bool profilerOverlayShown = false;
+std::string tracePath;
+const auto profilerEpoch = std::chrono::steady_clock::now();
+
+struct ProfileSample {
+    uint64_t start;    // nanoseconds since profilerEpoch
+    uint32_t duration; // nanoseconds
+    uint32_t phase;
+};
+
+struct ProfileRing {
+    ProfileSample samples[PROFILE_RING_SIZE];
+    std::atomic<uint64_t> written{ 0 };
+    std::atomic<bool> owned{ false };
+    uint32_t thread = 0;  // registration order, stable for the ring's lifetime
+    uint64_t drained = 0; // samples before this were taken by drainProfileSamples()
+};
+
+std::mutex profileRingsMutex;
+std::vector<std::unique_ptr<ProfileRing>> profileRings; // never shrinks; rings are reused
+
+// The calling thread's ring, claimed on first use and released when the thread exits
+ProfileRing& threadProfileRing() {
+    struct Claim {
+        ProfileRing* ring = nullptr;
+        ~Claim() {
+            if (ring) ring->owned.store(false, std::memory_order_release);
+        }
+    };
+    thread_local Claim claim;
+    if (!claim.ring) {
+        std::lock_guard<std::mutex> lock(profileRingsMutex);
+        for (auto& ring : profileRings) {
+            if (!ring->owned.load(std::memory_order_acquire)) {
+                claim.ring = ring.get();
+                break;
+            }
+        }
+        if (!claim.ring) {
+            profileRings.emplace_back(new ProfileRing);
+            claim.ring = profileRings.back().get();
+            claim.ring->thread = (uint32_t)(profileRings.size() - 1);
+        }
+        claim.ring->owned.store(true, std::memory_order_relaxed);
+    }
+    return *claim.ring;
+}
+
+uint64_t profilerNanoseconds(std::chrono::steady_clock::time_point time) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(time - profilerEpoch).count();
+}
+
+void recordProfileSample(int phase, uint64_t start, uint64_t end) {
+    ProfileRing& ring = threadProfileRing();
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    ProfileSample& sample = ring.samples[index & (PROFILE_RING_SIZE - 1)];
+    sample.start = start;
+    sample.duration = (uint32_t)std::min<uint64_t>(end - start, UINT32_MAX);
+    sample.phase = (uint32_t)phase;
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+struct PhaseTimer {
+    int phase;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+
+    explicit PhaseTimer(int phase) : phase(phase), active(profilerEnabled.load(std::memory_order_relaxed)) {
+        if (active) start = std::chrono::steady_clock::now();
+    }
+    ~PhaseTimer() {
+        stop();
+    }
+
+    // End the phase before the end of the scope
+    void stop() {
+        if (active) recordProfileSample(phase, profilerNanoseconds(start), profilerNanoseconds(std::chrono::steady_clock::now()));
+        active = false;
+    }
+};
+
+// Append a ring's samples from index `from` on that are still intact, with the
+// ring's thread; returns the ring's end index. Call with profileRingsMutex held.
+uint64_t copyRingSamples(const ProfileRing& ring, uint64_t from, std::vector<ProfileSample>& samples, std::vector<uint32_t>* threads) {
+    uint64_t end = ring.written.load(std::memory_order_acquire);
+    uint64_t begin = std::max<uint64_t>(from, end > PROFILE_RING_SIZE ? end - PROFILE_RING_SIZE : 0);
+    size_t first = samples.size();
+    for (uint64_t i = begin; i < end; i++) {
+        samples.push_back(ring.samples[i & (PROFILE_RING_SIZE - 1)]);
+    }
+    // Drop the oldest samples if the owner wrapped around onto them while they were copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now = ring.written.load(std::memory_order_relaxed);
+    uint64_t intact = now > PROFILE_RING_SIZE ? now - PROFILE_RING_SIZE : 0;
+    if (intact > begin) {
+        samples.erase(samples.begin() + first, samples.begin() + first + (size_t)std::min(intact - begin, end - begin));
+    }
+    if (threads) threads->resize(samples.size(), ring.thread);
+    return end;
+}
+
+// Copy the samples currently held by every ring, with the thread that recorded them
+void collectProfileSamples(std::vector<ProfileSample>& samples, std::vector<uint32_t>* threads = nullptr) {
+    samples.clear();
+    if (threads) threads->clear();
+    std::lock_guard<std::mutex> lock(profileRingsMutex);
+    for (auto& ring : profileRings) {
+        copyRingSamples(*ring, 0, samples, threads);
+    }
+}
+
+// Move every sample recorded since the last drain to the end of samples; returns how many were lost to wrap-around
+uint64_t drainProfileSamples(std::vector<ProfileSample>& samples, std::vector<uint32_t>& threads) {
+    uint64_t lost = 0;
+    std::lock_guard<std::mutex> lock(profileRingsMutex);
+    for (auto& ring : profileRings) {
+        size_t before = samples.size();
+        uint64_t end = copyRingSamples(*ring, ring->drained, samples, &threads);
+        lost += end - ring->drained - (samples.size() - before);
+        ring->drained = end;
+    }
+    return lost;
+}
+
+// p50, p95 and p99 of each phase's durations in milliseconds; counts[p] = 0 when a phase has no samples
+void profilePercentiles(const std::vector<ProfileSample>& samples, double percentiles[PHASE_COUNT][3], size_t counts[PHASE_COUNT]) {
+    static const double levels[3] = { 0.50, 0.95, 0.99 };
+    std::vector<uint32_t> durations[PHASE_COUNT];
+    for (const ProfileSample& sample : samples) {
+        if (sample.phase < PHASE_COUNT) durations[sample.phase].push_back(sample.duration);
+    }
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        std::vector<uint32_t>& values = durations[phase];
+        counts[phase] = values.size();
+        std::sort(values.begin(), values.end());
+        for (int l = 0; l < 3; l++) {
+            percentiles[phase][l] = values.empty() ? 0.0 : values[(size_t)(levels[l] * (values.size() - 1) + 0.5)] / 1e6;
+        }
+    }
+}
+
+// Chrome trace export
+// With --trace FILE every timer records, and the samples are drained from the
+// rings into traceSamples once per frame or evolution step and at exit, when
+// they are written as Chrome trace-event JSON (complete "X" events with one
+// track per ring) for chrome://tracing or ui.perfetto.dev. Samples a ring
+// overwrote before a drain are counted and reported rather than written.
+std::vector<ProfileSample> traceSamples;
+std::vector<uint32_t> traceThreads;
+uint64_t traceLostSamples = 0;
+
+void drainTrace() {
+    if (!tracePath.empty()) traceLostSamples += drainProfileSamples(traceSamples, traceThreads);
+}
+
+bool writeTrace() {
+    drainTrace();
+    FILE* file = fopen(tracePath.c_str(), "w");
+    if (!file) {
+        std::cerr << "Cannot create " << tracePath << std::endl;
+        return false;
+    }
+    uint32_t tracks = 0;
+    for (uint32_t thread : traceThreads) tracks = std::max(tracks, thread + 1);
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"rde\"}}");
+    for (uint32_t track = 0; track < tracks; track++) {
+        std::string name = track == 0 ? "main" : "worker " + std::to_string(track);
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+            track, name.c_str());
+    }
+    for (size_t i = 0; i < traceSamples.size(); i++) {
+        const ProfileSample& sample = traceSamples[i];
+        if (sample.phase >= PHASE_COUNT) continue;
+        fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u}",
+            PROFILE_PHASE_NAMES[sample.phase], PROFILE_PHASE_CATEGORIES[sample.phase], sample.start / 1e3, sample.duration / 1e3,
+            traceThreads[i]);
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        std::cerr << "Cannot write " << tracePath << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << traceSamples.size() << " trace events on " << tracks << " threads to " << tracePath;
+    if (traceLostSamples > 0) std::cout << " (" << traceLostSamples << " lost to full rings)";
+    std::cout << std::endl;
+    return true;
+}
+
+void writeTraceAtExit() {
+    writeTrace();
+}
@@ -0,0 +1,262 @@
+#pragma once
+// Self-check: headless round-trip and equivalence checks run with --self-check
+
+// Self-check
+// Each check generates a small catalog, runs it through one subsystem in a
+// temporary directory and compares the result with what went in: snapshots
+// (raw and packed), column packing, the CSV importer, the FFT, timeline seeks
+// in both directions, checkpoint restarts and independent contexts evolving
+// on separate threads. SELF_CHECK_STARS is deliberately not a multiple of the
+// packing block, so partial blocks are covered.
+bool selfCheck = false;
+const size_t SELF_CHECK_STARS = 5000;
+
+bool sameStars(const std::vector<Star>& a, const std::vector<Star>& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(Star)) == 0;
+}
+
+bool sameCatalogs(const SimulationContext& a, const SimulationContext& b) {
+    return sameStars(a.keplerianStars, b.keplerianStars) && sameStars(a.flatRotationStars, b.flatRotationStars);
+}
+
+bool reportCheck(const char* name, bool ok) {
+    std::cout << (ok ? "ok     " : "FAILED ") << name << std::endl;
+    return ok;
+}
+
+// Raw snapshots, including a state column, load back bit for bit
+bool checkSnapshotRoundTrip(const std::filesystem::path& directory) {
+    SimulationContext original, loaded;
+    initializeStars(original, 1, SELF_CHECK_STARS);
+    std::string path = (directory / "raw.rdesnap").string();
+    std::string state("state\0with a zero byte", 22);
+    std::string loadedState;
+    return writeSnapshot(path, original.keplerianStars.data(), original.flatRotationStars.data(), SELF_CHECK_STARS,
+        original.observerVelocity, 0.0f, state) &&
+        loadSnapshot(loaded, path, true, &loadedState) && sameCatalogs(original, loaded) && loadedState == state;
+}
+
+// Packed snapshots come back in Morton order, within the tolerance, with the
+// Doppler colours recomputed
+bool checkPackedSnapshotRoundTrip(const std::filesystem::path& directory) {
+    const float tolerance = 1e-3f;
+    SimulationContext original, loaded;
+    initializeStars(original, 2, SELF_CHECK_STARS);
+    std::string path = (directory / "packed.rdesnap").string();
+    if (!writeSnapshot(path, original.keplerianStars.data(), original.flatRotationStars.data(), SELF_CHECK_STARS,
+        original.observerVelocity, tolerance, std::string()) || !loadSnapshot(loaded, path, true)) {
+        return false;
+    }
+
+    std::vector<uint32_t> order = mortonOrder(original.keplerianStars.data(), SELF_CHECK_STARS);
+    glm::vec3 observerVel(0.0f, 0.0f, loaded.observerVelocity);
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        const std::vector<Star>& before = starsForModel(original, model);
+        const std::vector<Star>& after = starsForModel(loaded, model);
+        if (after.size() != before.size()) return false;
+        for (size_t i = 0; i < after.size(); i++) {
+            for (int field = 0; field < FIELD_DOPPLER_COLOR; field++) {
+                float limit = (field == FIELD_COLOR ? 1.0f / 1024.0f : tolerance) * 1.001f;
+                for (int component = 0; component < 3; component++) {
+                    float error = starComponent(after[i], field, component) - starComponent(before[order[i]], field, component);
+                    if (!(std::fabs(error) <= limit)) return false;
+                }
+            }
+            float rgb[3];
+            dopplerShiftedStarColor(after[i].velocity, observerVel, rgb);
+            if (memcmp(rgb, after[i].dopplerShiftedColor, sizeof(rgb)) != 0) return false;
+        }
+    }
+    return true;
+}
+
+// packColumn() and decodePackedBlock() agree on awkward columns, and refuse values the quantizer cannot hold
+bool checkColumnPacking() {
+    const float step = 1e-3f;
+    std::vector<std::vector<float>> columns;
+    columns.push_back(std::vector<float>(1, -3.25f));
+    columns.push_back(std::vector<float>(129, 7.0f));
+    std::vector<float> alternating(300), ramp(1000);
+    for (size_t i = 0; i < alternating.size(); i++) alternating[i] = i % 2 ? -1000.0f : 1000.0f;
+    for (size_t i = 0; i < ramp.size(); i++) ramp[i] = -0.5f + 0.00137f * i;
+    columns.push_back(alternating);
+    columns.push_back(ramp);
+
+    for (const std::vector<float>& values : columns) {
+        std::vector<unsigned char> packed;
+        std::vector<size_t> blockOffsets;
+        if (!packColumn(values.data(), values.size(), step, packed) ||
+            !packedBlockOffsets(packed.data(), packed.size(), values.size(), blockOffsets)) {
+            return false;
+        }
+        size_t blockCount = blockOffsets.size() - 1;
+        alignas(16) float decoded[PACK_BLOCK];
+        for (size_t block = 0; block < blockCount; block++) {
+            decodePackedBlock(packed.data(), blockCount, blockOffsets, block, step, decoded);
+            for (size_t i = block * PACK_BLOCK; i < std::min(values.size(), (block + 1) * PACK_BLOCK); i++) {
+                if (!(std::fabs(decoded[i - block * PACK_BLOCK] - values[i]) <= 0.5001f * step)) return false;
+            }
+        }
+    }
+
+    std::vector<float> huge(10, 1e12f);
+    std::vector<unsigned char> packed;
+    return !packColumn(huge.data(), huge.size(), step, packed);
+}
+
+// The CSV importer copes with a byte order mark, extra and reordered columns,
+// quoting, CRLF line ends, blank lines, signs and exponents, a missing final
+// newline, and skips malformed rows
+bool checkCsvImport(const std::filesystem::path& directory) {
+    std::string path = (directory / "catalog.csv").string();
+    std::ofstream csv(path, std::ios::binary);
+    csv << "\xEF\xBB\xBF" "id, vx ,x,y,\"z\",vy,vz,name\r\n"
+        << "1,0.25,1.5,-2,3e-1,+0.5,-1E-2,\"first\"\r\n"
+        << "\r\n"
+        << "2,null,1,2,3,4,5,missing\r\n"
+        << "3,-0.125, 4 ,5,6,0,0.75,third";
+    csv.close();
+
+    SimulationContext ctx;
+    if (!csv || !importCatalogCSV(ctx, path) || ctx.keplerianStars.size() != 2) return false;
+    const Star& first = ctx.keplerianStars[0];
+    const Star& third = ctx.keplerianStars[1];
+    return first.position == glm::vec3(1.5f, -2.0f, 0.3f) && first.velocity == glm::vec3(0.25f, 0.5f, -0.01f) &&
+        third.position == glm::vec3(4.0f, 5.0f, 6.0f) && third.velocity == glm::vec3(-0.125f, 0.0f, 0.75f) &&
+        sameStars(ctx.keplerianStars, ctx.flatRotationStars);
+}
+
+// The FFT matches a direct DFT, and the inverse transform restores the input
+bool checkFft() {
+    const size_t n = 64;
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<float> values(-1.0f, 1.0f);
+    std::vector<std::complex<float>> input(n);
+    for (auto& value : input) value = std::complex<float>(values(generator), values(generator));
+
+    FftPlan plan(n);
+    std::vector<std::complex<float>> data = input;
+    plan.transform(data.data(), false);
+    for (size_t k = 0; k < n; k++) {
+        std::complex<double> sum = 0.0;
+        for (size_t t = 0; t < n; t++) {
+            sum += std::complex<double>(input[t]) * std::polar(1.0, -2.0 * M_PI * (double)(k * t % n) / n);
+        }
+        if (std::abs(std::complex<double>(data[k]) - sum) > 1e-4 * n) return false;
+    }
+    plan.transform(data.data(), true);
+    for (size_t t = 0; t < n; t++) {
+        if (std::abs(data[t] / (float)n - input[t]) > 1e-5f) return false;
+    }
+    return true;
+}
+
+// Every step of a recorded timeline decodes to the same state whichever step
+// the player comes from, and stays close to the evolved state
+bool checkTimelineSeek(const std::filesystem::path& directory) {
+    const uint64_t steps = 20;
+    std::string path = (directory / "timeline.rdetl").string();
+    keyframeInterval = 7;
+    SimulationContext evolved;
+    initializeStars(evolved, 3, SELF_CHECK_STARS);
+    evolved.recorder.reset(new TimelineRecorder);
+    if (!evolved.recorder->open(evolved, path)) return false;
+    evolved.recorder->append(evolved, evolved.simulationStep);
+    while (evolved.simulationStep < steps) advanceSimulation(evolved);
+    if (!closeTimelineRecording(evolved)) return false;
+
+    SimulationContext scrubbed;
+    TimelinePlayer player;
+    if (!player.open(scrubbed, path)) return false;
+    const int64_t targets[] = { 20, 19, 18, 14, 13, 3, 17, 16, 0, 9, 8, 20 };
+    for (int64_t target : targets) {
+        player.seek(scrubbed, target);
+        SimulationContext direct;
+        TimelinePlayer fresh;
+        if (!fresh.open(direct, path)) return false;
+        fresh.seek(direct, target);
+        if (!sameCatalogs(scrubbed, direct) || scrubbed.simulationStep != (uint64_t)target) return false;
+    }
+
+    player.seek(scrubbed, steps);
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        for (size_t i = 0; i < SELF_CHECK_STARS; i++) {
+            const Star& a = starsForModel(evolved, model)[i];
+            const Star& b = starsForModel(scrubbed, model)[i];
+            if (glm::length(a.position - b.position) > 1e-3f || glm::length(a.velocity - b.velocity) > 1e-3f) return false;
+        }
+    }
+    return true;
+}
+
+// A run restarted from a checkpoint continues bit for bit, random generator included
+bool checkCheckpointRestart(const std::filesystem::path& directory) {
+    checkpointPrefix = (directory / "checkpoint").string();
+    checkpointInterval = 5;
+    SimulationContext original;
+    initializeStars(original, 4, SELF_CHECK_STARS);
+    while (original.simulationStep < 12) advanceSimulation(original);
+    bool written = finishCheckpoints(original);
+
+    SimulationContext restarted;
+    bool ok = written && restartFromCheckpoint(restarted, checkpointStatePath(10));
+    checkpointInterval = 0;
+    if (!ok) return false;
+    while (restarted.simulationStep < 12) advanceSimulation(restarted);
+    return sameCatalogs(original, restarted) && original.gen == restarted.gen &&
+        original.simulationTime == restarted.simulationTime;
+}
+
+// Contexts evolved at the same time on separate threads end up exactly as when evolved alone
+bool checkIndependentContexts() {
+    const int contexts = 2;
+    SimulationContext alone[contexts], together[contexts];
+    for (int c = 0; c < contexts; c++) {
+        initializeStars(alone[c], 10 + c, SELF_CHECK_STARS);
+        initializeStars(together[c], 10 + c, SELF_CHECK_STARS);
+        alone[c].observerVelocity = together[c].observerVelocity = 0.1f * (c + 1);
+        alone[c].timeStep = together[c].timeStep = 0.01f * (c + 1);
+        while (alone[c].simulationStep < 10) advanceSimulation(alone[c]);
+    }
+
+    std::vector<std::thread> threads;
+    for (int c = 0; c < contexts; c++) {
+        threads.emplace_back([&together, c]() {
+            while (together[c].simulationStep < 10) advanceSimulation(together[c]);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    for (int c = 0; c < contexts; c++) {
+        if (!sameCatalogs(alone[c], together[c])) return false;
+    }
+    return true;
+}
+
+// Run every check; false when any fails
+bool runSelfCheck() {
+    std::error_code error;
+    char name[32];
+    snprintf(name, sizeof(name), "rde_selfcheck_%08x", (unsigned int)rd());
+    std::filesystem::path directory = std::filesystem::temp_directory_path(error) / name;
+    if (error || !std::filesystem::create_directories(directory, error)) {
+        std::cerr << "Cannot create a temporary directory for the self-check" << std::endl;
+        return false;
+    }
+    checkpointInterval = 0;
+    recordPath.clear();
+
+    bool ok = true;
+    ok = reportCheck("snapshot round trip", checkSnapshotRoundTrip(directory)) && ok;
+    ok = reportCheck("packed snapshot round trip", checkPackedSnapshotRoundTrip(directory)) && ok;
+    ok = reportCheck("column packing", checkColumnPacking()) && ok;
+    ok = reportCheck("CSV import", checkCsvImport(directory)) && ok;
+    ok = reportCheck("FFT", checkFft()) && ok;
+    ok = reportCheck("timeline seek equivalence", checkTimelineSeek(directory)) && ok;
+    ok = reportCheck("checkpoint restart", checkCheckpointRestart(directory)) && ok;
+    ok = reportCheck("independent contexts", checkIndependentContexts()) && ok;
+
+    std::filesystem::remove_all(directory, error);
+    std::cout << (ok ? "All self-checks passed" : "Self-check failed") << std::endl;
+    return ok;
+}
@@ -0,0 +1,1262 @@
+#pragma once
+// Snapshot storage: the columnar file format, packed columns, memory-mapped and
+// asynchronous file I/O, snapshot reading and writing, and the initial-conditions cache
+
+// Snapshot command line options
+std::string loadSnapshotPath;
+std::string saveSnapshotPath;
+bool verifySnapshotChecksums = true;
+
+// Snapshot file format
+// A snapshot holds the star catalog as a fixed-size header followed by one
+// column per scalar star field (structure of arrays). Every column starts on a
+// SNAPSHOT_ALIGNMENT boundary, so a memory-mapped file can be read in place.
+const char SNAPSHOT_MAGIC[8] = { 'R', 'D', 'E', 'S', 'N', 'A', 'P', '\0' };
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint64_t SNAPSHOT_ALIGNMENT = 4096;
+const int SNAPSHOT_MAX_COLUMNS = 64;
+const size_t SNAPSHOT_CHUNK_STARS = 1 << 20;
+volatile unsigned int prefetchSink = 0; // keeps page-touching reads from being optimized away
+
+// Star fields stored per model, three float components each
+enum StarField {
+    FIELD_POSITION = 0,
+    FIELD_VELOCITY = 1,
+    FIELD_COLOR = 2,
+    FIELD_DOPPLER_COLOR = 3,
+    FIELD_COUNT = 4
+};
+
+enum StarModel {
+    MODEL_KEPLERIAN = 0,
+    MODEL_FLAT_ROTATION = 1,
+    MODEL_COUNT = 2
+};
+
+enum SnapshotCodec {
+    CODEC_RAW = 0,    // float32 values
+    CODEC_PACKED = 1  // quantized, delta-encoded and bit-packed (see packColumn)
+};
+
+struct SnapshotColumn {
+    uint32_t id;            // (model << 8) | (field << 4) | component
+    uint32_t elementSize;   // bytes per decoded element, 4 for float32
+    uint64_t offset;        // from the start of the file
+    uint64_t bytes;         // stored bytes
+    uint64_t checksum;      // of the stored bytes
+    uint32_t codec;
+    float quantizationStep; // packed columns decode as quantized value * step
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount;
+    uint64_t starCount;
+    float galaxyRadius;
+    float maxVelocity;
+    float flatRotationVelocity;
+    float observerVelocity; // observer velocity the Doppler colour columns were computed for
+    uint64_t headerChecksum; // checksum of the header with this field zeroed
+    SnapshotColumn columns[SNAPSHOT_MAX_COLUMNS];
+};
+
+uint32_t snapshotColumnId(int model, int field, int component) {
+    return (uint32_t)((model << 8) | (field << 4) | component);
+}
+
+std::vector<Star>& starsForModel(SimulationContext& ctx, int model) {
+    return model == MODEL_KEPLERIAN ? ctx.keplerianStars : ctx.flatRotationStars;
+}
+
+const std::vector<Star>& starsForModel(const SimulationContext& ctx, int model) {
+    return model == MODEL_KEPLERIAN ? ctx.keplerianStars : ctx.flatRotationStars;
+}
+
+float& starComponent(Star& star, int field, int component) {
+    switch (field) {
+    case FIELD_POSITION: return star.position[component];
+    case FIELD_VELOCITY: return star.velocity[component];
+    case FIELD_COLOR: return star.color[component];
+    default: return star.dopplerShiftedColor[component];
+    }
+}
+
+float starComponent(const Star& star, int field, int component) {
+    return starComponent(const_cast<Star&>(star), field, component);
+}
+
+uint64_t alignSnapshotOffset(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+// 64-bit checksum over whole 8-byte words, fast enough to verify gigabytes per second.
+// Feeding a column in pieces gives the same result as one call as long as every
+// piece except the last is a multiple of 8 bytes.
+uint64_t snapshotChecksum(const void* data, uint64_t bytes, uint64_t hash = 0x9E3779B97F4A7C15ull) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t words = bytes / 8;
+    for (uint64_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, p + i * 8, 8);
+        hash = (hash ^ w) * 0x100000001B3ull;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = bytes - words * 8;
+    if (tail > 0) {
+        uint64_t w = 0;
+        memcpy(&w, p + words * 8, (size_t)tail);
+        hash = (hash ^ w) * 0x100000001B3ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+uint64_t snapshotHeaderChecksum(const SnapshotHeader& header) {
+    SnapshotHeader copy = header;
+    copy.headerChecksum = 0;
+    return snapshotChecksum(&copy, sizeof(copy));
+}
+
+// Snapshot column compression
+// Packed columns quantize each value to a multiple of quantizationStep
+// (so the error is at most half a step), delta-encode consecutive values and
+// bit-pack the zigzagged deltas in blocks of 128 with a per-block bit width.
+// Stars are written in Morton order so neighbouring entries are neighbours in
+// space and their deltas stay small. Each block stores its first value, so
+// blocks decode independently. The bits use the four-lane interleaved layout
+// of SIMD-BP128: lane l holds values l, l + 4, l + 8, ..., and unpacking one
+// 128-bit word group yields four consecutive values.
+//
+// Column layout: uint32 blockCount, int32 base[blockCount], uint8 width[blockCount],
+// zero padding to 16 bytes, then 16 * width bytes of packed deltas per block.
+const size_t PACK_BLOCK = 128;
+
+uint32_t zigzagEncode(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+int32_t zigzagDecode(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+size_t packedHeaderBytes(size_t blockCount) {
+    return (4 + blockCount * 5 + 15) / 16 * 16;
+}
+
+// Bit-pack 128 zigzagged deltas into 4 * width words
+void packBlock128(const uint32_t* values, int width, uint32_t* out) {
+    memset(out, 0, (size_t)width * 4 * sizeof(uint32_t));
+    if (width == 0) return;
+    for (int lane = 0; lane < 4; lane++) {
+        for (int k = 0; k < 32; k++) {
+            uint32_t value = values[k * 4 + lane];
+            int bit = k * width;
+            int word = bit >> 5;
+            int shift = bit & 31;
+            out[word * 4 + lane] |= value << shift;
+            if (shift + width > 32) {
+                out[(word + 1) * 4 + lane] |= value >> (32 - shift);
+            }
+        }
+    }
+}
+
+// Unpack a block back into absolute quantized values, starting from base
+void unpackBlock128(const uint32_t* in, int width, int32_t base, int32_t* out) {
+    if (width == 0) {
+        for (size_t i = 0; i < PACK_BLOCK; i++) out[i] = base;
+        return;
+    }
+#ifdef RDE_HAVE_SSE2
+    const __m128i mask = width == 32 ? _mm_set1_epi32(-1) : _mm_set1_epi32((int)((1u << width) - 1));
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i running = _mm_set1_epi32(base);
+    for (int k = 0; k < 32; k++) {
+        int bit = k * width;
+        int word = bit >> 5;
+        int shift = bit & 31;
+        __m128i v = _mm_srl_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + word * 4)), _mm_cvtsi32_si128(shift));
+        if (shift + width > 32) {
+            __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + (word + 1) * 4));
+            v = _mm_or_si128(v, _mm_sll_epi32(high, _mm_cvtsi32_si128(32 - shift)));
+        }
+        v = _mm_and_si128(v, mask);
+        v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(zero, _mm_and_si128(v, one)));
+        // Prefix sum of the four deltas plus the last value of the previous group
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, running);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k * 4), v);
+        running = _mm_shuffle_epi32(v, 0xFF);
+    }
+#else
+    uint32_t mask = width == 32 ? 0xffffffffu : (1u << width) - 1;
+    int32_t running = base;
+    for (int k = 0; k < 32; k++) {
+        int bit = k * width;
+        int word = bit >> 5;
+        int shift = bit & 31;
+        for (int lane = 0; lane < 4; lane++) {
+            uint32_t value = in[word * 4 + lane] >> shift;
+            if (shift + width > 32) value |= in[(word + 1) * 4 + lane] << (32 - shift);
+            running += zigzagDecode(value & mask);
+            out[k * 4 + lane] = running;
+        }
+    }
+#endif
+}
+
+// Convert a block of quantized values back to floats
+void dequantizeBlock128(const int32_t* in, float step, float* out) {
+#ifdef RDE_HAVE_SSE2
+    const __m128 scale = _mm_set1_ps(step);
+    for (size_t i = 0; i < PACK_BLOCK; i += 4) {
+        __m128 value = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+        _mm_storeu_ps(out + i, _mm_mul_ps(value, scale));
+    }
+#else
+    for (size_t i = 0; i < PACK_BLOCK; i++) out[i] = (float)in[i] * step;
+#endif
+}
+
+// Pack a column; false when a value is too large for the step, in which case it is stored raw
+bool packColumn(const float* values, size_t count, float step, std::vector<unsigned char>& packed) {
+    size_t blockCount = (count + PACK_BLOCK - 1) / PACK_BLOCK;
+    std::vector<int32_t> quantized(blockCount * PACK_BLOCK, 0);
+    std::vector<unsigned char> widths(blockCount);
+    std::vector<int32_t> bases(blockCount);
+    std::atomic<bool> fits(true);
+
+    parallelFor(blockCount, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t block = begin; block < end; block++) {
+            int32_t* q = &quantized[block * PACK_BLOCK];
+            size_t first = block * PACK_BLOCK;
+            size_t n = std::min(PACK_BLOCK, count - first);
+            uint32_t bits = 0;
+            for (size_t i = 0; i < PACK_BLOCK; i++) {
+                float scaled = std::round(values[first + std::min(i, n - 1)] / step); // pad with the last value
+                if (!(std::fabs(scaled) < 1073741824.0f)) {
+                    fits = false;
+                    return;
+                }
+                q[i] = (int32_t)scaled;
+                bits |= i == 0 ? 0 : zigzagEncode(q[i] - q[i - 1]);
+            }
+            int width = 0;
+            while (width < 32 && (bits >> width) != 0) width++;
+            widths[block] = (unsigned char)width;
+            bases[block] = q[0];
+        }
+    });
+    if (!fits) return false;
+
+    std::vector<size_t> blockOffsets(blockCount + 1);
+    blockOffsets[0] = packedHeaderBytes(blockCount);
+    for (size_t block = 0; block < blockCount; block++) {
+        blockOffsets[block + 1] = blockOffsets[block] + (size_t)widths[block] * 16;
+    }
+    packed.assign(blockOffsets[blockCount], 0);
+    uint32_t count32 = (uint32_t)blockCount;
+    memcpy(packed.data(), &count32, 4);
+    memcpy(packed.data() + 4, bases.data(), blockCount * 4);
+    memcpy(packed.data() + 4 + blockCount * 4, widths.data(), blockCount);
+
+    parallelFor(blockCount, [&](size_t begin, size_t end, unsigned int) {
+        uint32_t deltas[PACK_BLOCK];
+        uint32_t words[PACK_BLOCK];
+        for (size_t block = begin; block < end; block++) {
+            const int32_t* q = &quantized[block * PACK_BLOCK];
+            deltas[0] = 0;
+            for (size_t i = 1; i < PACK_BLOCK; i++) deltas[i] = zigzagEncode(q[i] - q[i - 1]);
+            packBlock128(deltas, widths[block], words);
+            memcpy(packed.data() + blockOffsets[block], words, (size_t)widths[block] * 16);
+        }
+    });
+    return true;
+}
+
+// Validate a packed column and return the byte offset of every block
+bool packedBlockOffsets(const unsigned char* data, uint64_t bytes, size_t count, std::vector<size_t>& blockOffsets) {
+    size_t blockCount = (count + PACK_BLOCK - 1) / PACK_BLOCK;
+    uint32_t storedCount;
+    if (bytes < 4) return false;
+    memcpy(&storedCount, data, 4);
+    if (storedCount != blockCount || bytes < packedHeaderBytes(blockCount)) return false;
+    const unsigned char* widths = data + 4 + blockCount * 4;
+    blockOffsets.resize(blockCount + 1);
+    blockOffsets[0] = packedHeaderBytes(blockCount);
+    for (size_t block = 0; block < blockCount; block++) {
+        if (widths[block] > 32) return false;
+        blockOffsets[block + 1] = blockOffsets[block] + (size_t)widths[block] * 16;
+    }
+    return blockOffsets[blockCount] <= bytes;
+}
+
+// Decode one block of a packed column into 128 floats
+void decodePackedBlock(const unsigned char* data, size_t blockCount, const std::vector<size_t>& blockOffsets,
+    size_t block, float step, float* out) {
+    int32_t base;
+    memcpy(&base, data + 4 + block * 4, 4);
+    int width = data[4 + blockCount * 4 + block];
+    alignas(16) uint32_t words[PACK_BLOCK];
+    alignas(16) int32_t quantized[PACK_BLOCK];
+    memcpy(words, data + blockOffsets[block], (size_t)width * 16);
+    unpackBlock128(words, width, base, quantized);
+    dequantizeBlock128(quantized, step, out);
+}
+
+// Interleave the low 21 bits of x, y and z
+uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+    auto spread = [](uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffull;
+        v = (v | v << 16) & 0x1f0000ff0000ffull;
+        v = (v | v << 8) & 0x100f00f00f00f00full;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    };
+    return spread(x) | spread(y) << 1 | spread(z) << 2;
+}
+
+// Star order along a Morton curve through the Keplerian positions
+std::vector<uint32_t> mortonOrder(const Star* stars, size_t count) {
+    glm::vec3 lower(1e30f), upper(-1e30f);
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < 3; c++) {
+            lower[c] = std::min(lower[c], stars[i].position[c]);
+            upper[c] = std::max(upper[c], stars[i].position[c]);
+        }
+    }
+    std::vector<std::pair<uint64_t, uint32_t>> keys(count);
+    parallelFor(count, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t cell[3];
+            for (int c = 0; c < 3; c++) {
+                float extent = upper[c] - lower[c];
+                float t = extent > 0.0f ? (stars[i].position[c] - lower[c]) / extent : 0.0f;
+                cell[c] = (uint32_t)glm::clamp(t * 2097151.0f, 0.0f, 2097151.0f);
+            }
+            keys[i] = { mortonCode(cell[0], cell[1], cell[2]), (uint32_t)i };
+        }
+    });
+    std::sort(keys.begin(), keys.end());
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < keys.size(); i++) order[i] = keys[i].second;
+    return order;
+}
+
+// Read-only view of part of a file, unmapped when destroyed
+struct MappedWindow {
+    const unsigned char* data = nullptr; // first requested byte
+    void* base = nullptr;                // start of the mapping, aligned down
+    size_t length = 0;                   // bytes mapped from base
+
+    MappedWindow() {}
+    MappedWindow(const MappedWindow&) = delete;
+    MappedWindow& operator=(const MappedWindow&) = delete;
+    MappedWindow(MappedWindow&& other) noexcept { *this = std::move(other); }
+    MappedWindow& operator=(MappedWindow&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data = other.data;
+            base = other.base;
+            length = other.length;
+            other.data = nullptr;
+            other.base = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+    ~MappedWindow() { unmap(); }
+
+    void unmap() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+#else
+        if (base) munmap(base, length);
+#endif
+        data = nullptr;
+        base = nullptr;
+        length = 0;
+    }
+};
+
+// Read-only memory mapping of a file, either whole or in independent windows
+struct MappedFile {
+    const unsigned char* data = nullptr; // whole-file mapping, when requested
+    uint64_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path, bool mapWholeFile = true) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { close(); return false; }
+        size = (uint64_t)fileSize.QuadPart;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) { close(); return false; }
+        if (mapWholeFile) {
+            data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            if (data == nullptr) { close(); return false; }
+        }
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { close(); return false; }
+        size = (uint64_t)st.st_size;
+        if (mapWholeFile) {
+            void* p = mmap(nullptr, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) { close(); return false; }
+            data = static_cast<const unsigned char*>(p);
+        }
+#endif
+        return true;
+    }
+
+    // Map [offset, offset + length) of the file; the view is released with the window
+    bool mapWindow(uint64_t offset, uint64_t length, MappedWindow& window) const {
+        window.unmap();
+        if (length == 0 || offset > size || length > size - offset) return false;
+#ifdef _WIN32
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        uint64_t granularity = systemInfo.dwAllocationGranularity;
+#else
+        uint64_t granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+        uint64_t alignedOffset = offset / granularity * granularity;
+        size_t mappedLength = (size_t)(length + (offset - alignedOffset));
+#ifdef _WIN32
+        void* p = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(alignedOffset >> 32),
+            (DWORD)(alignedOffset & 0xffffffffu), mappedLength);
+        if (p == nullptr) return false;
+#else
+        void* p = mmap(nullptr, mappedLength, PROT_READ, MAP_SHARED, fd, (off_t)alignedOffset);
+        if (p == MAP_FAILED) return false;
+        madvise(p, mappedLength, MADV_SEQUENTIAL);
+#endif
+        window.base = p;
+        window.length = mappedLength;
+        window.data = static_cast<const unsigned char*>(p) + (offset - alignedOffset);
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(const_cast<unsigned char*>(data), (size_t)size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// Asynchronous positional file I/O
+// submitRead()/submitWrite() queue a request and return a ticket that wait()
+// blocks on, so callers can fill or consume one buffer while another is in
+// flight. On Linux requests go through an io_uring; elsewhere, or when the
+// kernel refuses to create a ring, they run as positional reads and writes on
+// ioPool, a few persistent threads shared by every open file and kept apart
+// from the compute workers so blocking I/O never holds up a parallelFor(). An
+// AsyncFileIO is driven from one thread.
+const int IO_THREADS = 2;
+WorkerPool ioPool;
+
+class AsyncFileIO {
+public:
+    AsyncFileIO() {}
+    AsyncFileIO(const AsyncFileIO&) = delete;
+    AsyncFileIO& operator=(const AsyncFileIO&) = delete;
+    ~AsyncFileIO() { close(); }
+
+    bool open(const std::string& path, bool forWriting) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), forWriting ? GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL,
+            forWriting ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+#else
+        fd = forWriting ? ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) : ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+#endif
+        failed = false;
+        usingRing = false;
+#ifdef RDE_HAVE_IO_URING
+        usingRing = ring.setup(fd);
+        if (usingRing) return true;
+#endif
+        ioPool.reserve(IO_THREADS);
+        return true;
+    }
+
+    uint64_t submitRead(uint64_t offset, void* buffer, size_t bytes) {
+        return submit(Request{ nextTicket++, offset, static_cast<unsigned char*>(buffer), bytes, false });
+    }
+
+    uint64_t submitWrite(uint64_t offset, const void* buffer, size_t bytes) {
+        return submit(Request{ nextTicket++, offset, static_cast<unsigned char*>(const_cast<void*>(buffer)), bytes, true });
+    }
+
+    // Block until the request completes; false when it failed
+    bool wait(uint64_t ticket) {
+        PhaseTimer timer(PHASE_IO_WAIT);
+#ifdef RDE_HAVE_IO_URING
+        if (ring.active()) {
+            while (!ring.finished(ticket)) {
+                ring.reap(true);
+            }
+            return ring.take(ticket);
+        }
+#endif
+        std::unique_lock<std::mutex> lock(mutex);
+        completed.wait(lock, [&]() { return results.count(ticket) > 0; });
+        bool ok = results[ticket];
+        results.erase(ticket);
+        return ok;
+    }
+
+    // Wait for every outstanding request and close the file; false if any request failed
+    bool close() {
+#ifdef RDE_HAVE_IO_URING
+        if (ring.active()) {
+            while (ring.inFlight() > 0) {
+                ring.reap(true);
+            }
+            failed = failed || ring.anyFailed();
+            ring.shutdown();
+        }
+#endif
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            completed.wait(lock, [&]() { return outstanding == 0; });
+            for (const auto& result : results) {
+                failed = failed || !result.second;
+            }
+            results.clear();
+        }
+#ifdef _WIN32
+        if (file == INVALID_HANDLE_VALUE) return !failed;
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (fd < 0) return !failed;
+        failed = (::close(fd) != 0) || failed;
+        fd = -1;
+#endif
+        return !failed;
+    }
+
+    // Backend used by the file opened last
+    const char* backendName() const {
+        return usingRing ? "io_uring" : "thread pool";
+    }
+
+private:
+    struct Request {
+        uint64_t ticket;
+        uint64_t offset;
+        unsigned char* buffer;
+        size_t bytes;
+        bool write;
+    };
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+    uint64_t nextTicket = 1;
+    bool failed = false;
+    bool usingRing = false;
+
+    std::mutex mutex;
+    std::condition_variable completed;
+    std::unordered_map<uint64_t, bool> results;
+    size_t outstanding = 0; // requests queued on ioPool and not yet finished
+
+    uint64_t submit(const Request& request) {
+#ifdef RDE_HAVE_IO_URING
+        if (ring.active()) {
+            ring.submit(request.ticket, request.offset, request.buffer, request.bytes, request.write);
+            return request.ticket;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            outstanding++;
+        }
+        ioPool.post([this, request]() {
+            bool ok = transfer(request.offset, request.buffer, request.bytes, request.write);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                results[request.ticket] = ok;
+                outstanding--;
+                completed.notify_all(); // under the lock, as close() may destroy this object once it sees none outstanding
+            }
+        });
+        return request.ticket;
+    }
+
+    // Run a whole request synchronously at its file offset
+    bool transfer(uint64_t offset, unsigned char* buffer, size_t bytes, bool write) {
+        while (bytes > 0) {
+            size_t piece = std::min<size_t>(bytes, 1u << 30);
+#ifdef _WIN32
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = (DWORD)(offset & 0xffffffffu);
+            overlapped.OffsetHigh = (DWORD)(offset >> 32);
+            DWORD done = 0;
+            BOOL ok = write ? WriteFile(file, buffer, (DWORD)piece, &done, &overlapped)
+                : ReadFile(file, buffer, (DWORD)piece, &done, &overlapped);
+            if (!ok || done == 0) return false;
+#else
+            ssize_t done = write ? pwrite(fd, buffer, piece, (off_t)offset) : pread(fd, buffer, piece, (off_t)offset);
+            if (done <= 0) return false;
+#endif
+            offset += (uint64_t)done;
+            buffer += done;
+            bytes -= (size_t)done;
+        }
+        return true;
+    }
+
+#ifdef RDE_HAVE_IO_URING
+    // Minimal io_uring driven through the raw system calls
+    struct Ring {
+        static const unsigned ENTRIES = 64;
+        int ringFd = -1;
+        int fileFd = -1;
+        void* sqMemory = nullptr;
+        size_t sqMemoryBytes = 0;
+        void* cqMemory = nullptr;
+        size_t cqMemoryBytes = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqesBytes = 0;
+        unsigned* sqHead = nullptr;
+        unsigned* sqTail = nullptr;
+        unsigned* sqMask = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned* cqMask = nullptr;
+        io_uring_cqe* cqes = nullptr;
+
+        struct Pending {
+            uint64_t offset;
+            unsigned char* buffer;
+            size_t bytes;
+            bool write;
+        };
+        std::unordered_map<uint64_t, Pending> inFlightRequests;
+        std::unordered_map<uint64_t, bool> results;
+
+        bool active() const { return ringFd >= 0; }
+        size_t inFlight() const { return inFlightRequests.size(); }
+        bool anyFailed() const {
+            for (const auto& result : results) {
+                if (!result.second) return true;
+            }
+            return false;
+        }
+
+        bool setup(int fd) {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            ringFd = (int)syscall(__NR_io_uring_setup, ENTRIES, &params);
+            if (ringFd < 0) return false;
+            fileFd = fd;
+
+            sqMemoryBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqMemoryBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+            sqMemory = mmap(nullptr, sqMemoryBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+            cqMemory = mmap(nullptr, cqMemoryBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+            void* sqeMemory = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+            if (sqMemory == MAP_FAILED || cqMemory == MAP_FAILED || sqeMemory == MAP_FAILED) {
+                if (sqMemory == MAP_FAILED) sqMemory = nullptr;
+                if (cqMemory == MAP_FAILED) cqMemory = nullptr;
+                if (sqeMemory != MAP_FAILED) munmap(sqeMemory, sqesBytes);
+                shutdown();
+                return false;
+            }
+
+            unsigned char* sq = static_cast<unsigned char*>(sqMemory);
+            unsigned char* cq = static_cast<unsigned char*>(cqMemory);
+            sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            sqes = static_cast<io_uring_sqe*>(sqeMemory);
+            return true;
+        }
+
+        void shutdown() {
+            if (sqes) munmap(sqes, sqesBytes);
+            if (sqMemory) munmap(sqMemory, sqMemoryBytes);
+            if (cqMemory) munmap(cqMemory, cqMemoryBytes);
+            if (ringFd >= 0) ::close(ringFd);
+            sqes = nullptr;
+            sqMemory = nullptr;
+            cqMemory = nullptr;
+            ringFd = -1;
+            inFlightRequests.clear();
+            results.clear();
+        }
+
+        void submit(uint64_t ticket, uint64_t offset, unsigned char* buffer, size_t bytes, bool write) {
+            while (inFlightRequests.size() >= ENTRIES) {
+                reap(true);
+            }
+            inFlightRequests[ticket] = Pending{ offset, buffer, bytes, write };
+            push(ticket, inFlightRequests[ticket]);
+        }
+
+        void push(uint64_t ticket, const Pending& request) {
+            unsigned tail = *sqTail;
+            unsigned index = tail & *sqMask;
+            io_uring_sqe& sqe = sqes[index];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = request.write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe.fd = fileFd;
+            sqe.off = request.offset;
+            sqe.addr = (uint64_t)(uintptr_t)request.buffer;
+            sqe.len = (unsigned)std::min<size_t>(request.bytes, 1u << 30);
+            sqe.user_data = ticket;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0);
+        }
+
+        // Collect completions, resubmitting the remainder of short transfers
+        void reap(bool block) {
+            if (block && __atomic_load_n(cqHead, __ATOMIC_RELAXED) == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            }
+            unsigned head = __atomic_load_n(cqHead, __ATOMIC_RELAXED);
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            std::vector<std::pair<uint64_t, int>> completions;
+            for (; head != tail; head++) {
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                completions.emplace_back(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+            for (const auto& completion : completions) {
+                auto it = inFlightRequests.find(completion.first);
+                if (it == inFlightRequests.end()) continue;
+                Pending& request = it->second;
+                if (completion.second > 0 && (size_t)completion.second < request.bytes) {
+                    request.offset += completion.second;
+                    request.buffer += completion.second;
+                    request.bytes -= completion.second;
+                    push(completion.first, request);
+                    continue;
+                }
+                results[completion.first] = completion.second > 0 || (completion.second == 0 && request.bytes == 0);
+                inFlightRequests.erase(it);
+            }
+        }
+
+        bool finished(uint64_t ticket) {
+            reap(false);
+            return results.count(ticket) > 0;
+        }
+
+        bool take(uint64_t ticket) {
+            bool ok = results[ticket];
+            results.erase(ticket);
+            return ok;
+        }
+    };
+    Ring ring;
+#endif
+};
+
+float snapshotCompressionTolerance = 0.0f; // 0 stores raw float32 columns
+const uint32_t SNAPSHOT_STATE_COLUMN_ID = 0xff00; // opaque simulation state, see writeCheckpoint()
+
+// Write star catalogs of starCount stars each to a snapshot file. A non-empty
+// state is stored as an extra byte column that star loaders skip.
+bool writeSnapshot(const std::string& path, const Star* keplerian, const Star* flatRotation, size_t starCount,
+    float savedObserverVelocity, float compressionTolerance, const std::string& state) {
+    PhaseTimer timer(PHASE_SNAPSHOT);
+    auto startTime = std::chrono::steady_clock::now();
+
+    AsyncFileIO io;
+    if (!io.open(path, true)) {
+        std::cerr << "Cannot create snapshot " << path << std::endl;
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.starCount = starCount;
+    header.galaxyRadius = GALAXY_RADIUS;
+    header.maxVelocity = MAX_VELOCITY;
+    header.flatRotationVelocity = FLAT_ROTATION_VELOCITY;
+    header.observerVelocity = savedObserverVelocity;
+
+    // Packed snapshots store stars in Morton order and leave out the Doppler
+    // colours, which are recomputed on load
+    bool compress = compressionTolerance > 0.0f;
+    std::vector<uint32_t> order;
+    if (compress) order = mortonOrder(keplerian, starCount);
+    std::vector<float> columnValues;
+    std::vector<unsigned char> packedBuffers[2];
+
+    // Double buffering: one chunk is gathered while the previous one is written
+    std::vector<float> buffers[2] = { std::vector<float>(SNAPSHOT_CHUNK_STARS), std::vector<float>(SNAPSHOT_CHUNK_STARS) };
+    uint64_t tickets[2] = { 0, 0 };
+    int current = 0;
+    uint64_t offset = alignSnapshotOffset(sizeof(SnapshotHeader));
+    uint64_t storedBytes = 0;
+    bool ok = true;
+
+    for (int model = 0; model < MODEL_COUNT && ok; model++) {
+        const Star* stars = model == MODEL_KEPLERIAN ? keplerian : flatRotation;
+        for (int field = 0; field < FIELD_COUNT && ok; field++) {
+            if (compress && field == FIELD_DOPPLER_COLOR) continue;
+            for (int component = 0; component < 3 && ok; component++) {
+                SnapshotColumn& column = header.columns[header.columnCount++];
+                column.id = snapshotColumnId(model, field, component);
+                column.elementSize = sizeof(float);
+                column.offset = offset;
+                column.bytes = starCount * sizeof(float);
+                column.checksum = snapshotChecksum(nullptr, 0);
+                column.codec = CODEC_RAW;
+
+                if (compress) {
+                    // Colours are display values in [0, 1] whose 8-bit output must not
+                    // change, so they stay within 1/1024 (a quarter of an 8-bit step)
+                    // even when the tolerance chosen for positions and velocities is
+                    // much coarser
+                    float tolerance = field == FIELD_COLOR ? std::min(compressionTolerance, 1.0f / 1024.0f)
+                        : compressionTolerance;
+                    columnValues.resize(starCount);
+                    for (size_t i = 0; i < starCount; i++) {
+                        columnValues[i] = starComponent(stars[order[i]], field, component);
+                    }
+                    if (tickets[current]) {
+                        ok = io.wait(tickets[current]);
+                        tickets[current] = 0;
+                    }
+                    std::vector<unsigned char>& packed = packedBuffers[current];
+                    const void* stored = columnValues.data();
+                    if (packColumn(columnValues.data(), columnValues.size(), 2.0f * tolerance, packed)) {
+                        column.codec = CODEC_PACKED;
+                        column.quantizationStep = 2.0f * tolerance;
+                        column.bytes = packed.size();
+                        stored = packed.data();
+                    }
+                    else {
+                        // Out of range for the quantizer; write this column raw from a stable buffer
+                        packed.assign(reinterpret_cast<const unsigned char*>(columnValues.data()),
+                            reinterpret_cast<const unsigned char*>(columnValues.data() + columnValues.size()));
+                        stored = packed.data();
+                    }
+                    column.checksum = snapshotChecksum(stored, column.bytes);
+                    tickets[current] = io.submitWrite(column.offset, stored, (size_t)column.bytes);
+                    current ^= 1;
+                }
+                else {
+                    for (size_t begin = 0; begin < starCount && ok; begin += SNAPSHOT_CHUNK_STARS) {
+                        size_t count = std::min(SNAPSHOT_CHUNK_STARS, starCount - begin);
+                        if (tickets[current]) {
+                            ok = io.wait(tickets[current]);
+                            tickets[current] = 0;
+                        }
+                        float* buffer = buffers[current].data();
+                        for (size_t i = 0; i < count; i++) {
+                            buffer[i] = starComponent(stars[begin + i], field, component);
+                        }
+                        column.checksum = snapshotChecksum(buffer, count * sizeof(float), column.checksum);
+                        tickets[current] = io.submitWrite(column.offset + begin * sizeof(float), buffer, count * sizeof(float));
+                        current ^= 1;
+                    }
+                }
+                storedBytes += column.bytes;
+                offset = alignSnapshotOffset(offset + column.bytes);
+            }
+        }
+    }
+
+    if (!state.empty() && ok) {
+        SnapshotColumn& column = header.columns[header.columnCount++];
+        column.id = SNAPSHOT_STATE_COLUMN_ID;
+        column.elementSize = 1;
+        column.offset = offset;
+        column.bytes = state.size();
+        column.checksum = snapshotChecksum(state.data(), state.size());
+        column.codec = CODEC_RAW;
+        if (tickets[current]) ok = io.wait(tickets[current]);
+        tickets[current] = io.submitWrite(column.offset, state.data(), state.size());
+        storedBytes += column.bytes;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (tickets[i]) ok = io.wait(tickets[i]) && ok;
+    }
+    header.headerChecksum = snapshotHeaderChecksum(header);
+    ok = ok && io.wait(io.submitWrite(0, &header, sizeof(header)));
+    ok = io.close() && ok;
+    if (!ok) {
+        std::cerr << "Failed writing snapshot " << path << std::endl;
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Saved " << header.starCount << " stars to " << path << " in " << seconds << " s ("
+        << io.backendName() << ", " << storedBytes / 1e6 << " MB of columns)" << std::endl;
+    return true;
+}
+
+// Save both star catalogs to a snapshot file
+bool saveSnapshot(const SimulationContext& ctx, const std::string& path) {
+    return writeSnapshot(path, ctx.keplerianStars.data(), ctx.flatRotationStars.data(), ctx.keplerianStars.size(),
+        ctx.observerVelocity, snapshotCompressionTolerance, std::string());
+}
+
+// Read and check the header at the start of a snapshot
+bool readSnapshotHeader(const std::string& path, const unsigned char* data, uint64_t size, SnapshotHeader& header) {
+    if (size < 12 || memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        std::cerr << path << " is not a snapshot file" << std::endl;
+        return false;
+    }
+    uint32_t version;
+    memcpy(&version, data + sizeof(SNAPSHOT_MAGIC), sizeof(version));
+    if (version != SNAPSHOT_VERSION) {
+        std::cerr << "Unsupported snapshot version " << version << std::endl;
+        return false;
+    }
+    if (size < sizeof(SnapshotHeader)) {
+        std::cerr << "Snapshot " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if (header.headerChecksum != snapshotHeaderChecksum(header) || header.columnCount > SNAPSHOT_MAX_COLUMNS) {
+        std::cerr << "Snapshot " << path << " has a corrupt header" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Find the header index of every star column (-1 when absent) and check its bounds
+bool locateSnapshotColumns(const std::string& path, const SnapshotHeader& header, uint64_t fileSize,
+    int located[MODEL_COUNT][FIELD_COUNT][3], bool& haveDopplerColors) {
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            for (int component = 0; component < 3; component++) {
+                located[model][field][component] = -1;
+            }
+        }
+    }
+
+    for (uint32_t c = 0; c < header.columnCount; c++) {
+        const SnapshotColumn& column = header.columns[c];
+        int model = (column.id >> 8) & 0xff;
+        int field = (column.id >> 4) & 0xf;
+        int component = column.id & 0xf;
+        if (model >= MODEL_COUNT || field >= FIELD_COUNT || component >= 3) continue; // unknown column, skip
+
+        bool sizeMatches = column.codec == CODEC_PACKED ? column.quantizationStep > 0.0f
+            : column.codec == CODEC_RAW && header.starCount <= UINT64_MAX / sizeof(float) &&
+                column.bytes == header.starCount * sizeof(float);
+        if (column.elementSize != sizeof(float) || !sizeMatches ||
+            column.offset % SNAPSHOT_ALIGNMENT != 0 || column.offset > fileSize ||
+            column.bytes > fileSize - column.offset) {
+            std::cerr << "Snapshot " << path << " has an invalid column " << column.id << std::endl;
+            return false;
+        }
+        located[model][field][component] = (int)c;
+    }
+
+    haveDopplerColors = true;
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            for (int component = 0; component < 3; component++) {
+                if (located[model][field][component] >= 0) continue;
+                if (field == FIELD_DOPPLER_COLOR) {
+                    haveDopplerColors = false;
+                    continue;
+                }
+                std::cerr << "Snapshot " << path << " is missing column "
+                    << snapshotColumnId(model, field, component) << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Stars per block when copying raw columns (a 48 KB slice of the star array)
+const size_t SNAPSHOT_LOAD_BLOCK = 1024;
+
+// Load both star catalogs from a memory-mapped snapshot file
+bool loadSnapshot(SimulationContext& ctx, const std::string& path, bool verifyChecksums, std::string* state = nullptr) {
+    PhaseTimer timer(PHASE_SNAPSHOT);
+    releaseCheckpointStars(ctx);
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile mapped;
+    if (!mapped.open(path)) {
+        std::cerr << "Cannot open snapshot " << path << std::endl;
+        return false;
+    }
+
+    SnapshotHeader header;
+    int located[MODEL_COUNT][FIELD_COUNT][3];
+    bool haveDopplerColors;
+    if (!readSnapshotHeader(path, mapped.data, mapped.size, header) ||
+        !locateSnapshotColumns(path, header, mapped.size, located, haveDopplerColors)) {
+        return false;
+    }
+
+    // Check every column before touching the star arrays, a column per task
+    if (verifyChecksums) {
+        std::atomic<int> mismatch(-1);
+        parallelFor(ctx.threads, header.columnCount, [&](size_t begin, size_t end, unsigned int) {
+            for (size_t c = begin; c < end; c++) {
+                const SnapshotColumn& column = header.columns[c];
+                if (column.offset > mapped.size || column.bytes > mapped.size - column.offset) continue; // unknown column
+                if (snapshotChecksum(mapped.data + column.offset, column.bytes) != column.checksum) mismatch = (int)c;
+            }
+        });
+        if (mismatch >= 0) {
+            std::cerr << "Checksum mismatch in snapshot column " << header.columns[mismatch].id << std::endl;
+            return false;
+        }
+    }
+
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        std::vector<Star>& stars = starsForModel(ctx, model);
+        stars.resize((size_t)header.starCount);
+
+        // Raw columns are scattered a cache-sized block of stars at a time, so each star
+        // stays in cache while all of its columns are copied in
+        parallelFor(ctx.threads, stars.size(), [&](size_t begin, size_t end, unsigned int) {
+            for (size_t first = begin; first < end; first += SNAPSHOT_LOAD_BLOCK) {
+                size_t last = std::min(end, first + SNAPSHOT_LOAD_BLOCK);
+                for (int field = 0; field < FIELD_COUNT; field++) {
+                    for (int component = 0; component < 3; component++) {
+                        int c = located[model][field][component];
+                        if (c < 0 || header.columns[c].codec != CODEC_RAW) continue;
+                        const float* column = reinterpret_cast<const float*>(mapped.data + header.columns[c].offset);
+                        for (size_t i = first; i < last; i++) {
+                            starComponent(stars[i], field, component) = column[i];
+                        }
+                    }
+                }
+            }
+        });
+
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            for (int component = 0; component < 3; component++) {
+                int c = located[model][field][component];
+                if (c < 0 || header.columns[c].codec == CODEC_RAW) continue;
+                const unsigned char* data = mapped.data + header.columns[c].offset;
+                std::vector<size_t> blockOffsets;
+                if (!packedBlockOffsets(data, header.columns[c].bytes, stars.size(), blockOffsets)) {
+                    std::cerr << "Snapshot " << path << " has an invalid packed column " << header.columns[c].id << std::endl;
+                    return false;
+                }
+                size_t blockCount = blockOffsets.size() - 1;
+                float step = header.columns[c].quantizationStep;
+                parallelFor(ctx.threads, blockCount, [&](size_t begin, size_t end, unsigned int) {
+                    alignas(16) float values[PACK_BLOCK];
+                    for (size_t block = begin; block < end; block++) {
+                        decodePackedBlock(data, blockCount, blockOffsets, block, step, values);
+                        size_t first = block * PACK_BLOCK;
+                        size_t n = std::min(PACK_BLOCK, stars.size() - first);
+                        for (size_t i = 0; i < n; i++) {
+                            starComponent(stars[first + i], field, component) = values[i];
+                        }
+                    }
+                });
+            }
+        }
+    }
+
+    if (state) {
+        state->clear();
+        for (uint32_t c = 0; c < header.columnCount; c++) {
+            const SnapshotColumn& column = header.columns[c];
+            if (column.id != SNAPSHOT_STATE_COLUMN_ID || column.offset > mapped.size || column.bytes > mapped.size - column.offset) continue;
+            state->assign(reinterpret_cast<const char*>(mapped.data + column.offset), (size_t)column.bytes);
+        }
+    }
+
+    // Derived colours are only valid for the observer velocity they were saved with
+    if (!haveDopplerColors || header.observerVelocity != ctx.observerVelocity) {
+        updateDopplerShifts(ctx);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Loaded " << header.starCount << " stars from " << path << " in " << seconds << " s" << std::endl;
+    return true;
+}
+
+// Initial-conditions cache
+// Generating a catalog is deterministic for a fixed seed, so the snapshot of a
+// previous run with identical generation parameters can be loaded instead.
+// Cache files are named after a hash of those parameters; the least recently
+// used ones are evicted once the cache grows beyond its limits. Only runs with
+// --seed use the cache: a random seed never repeats, so its catalog would never
+// be loaded again. Each entry's state column holds the random generator state
+// after generation, so a loaded catalog continues with the same draws as a
+// generated one.
+std::string cacheDirectory;
+uint64_t cacheMaxBytes = 4096ull << 20;
+int cacheMaxEntries = 16;
+const uint32_t GENERATOR_VERSION = 1; // bump when initializeStars() output changes
+
+struct GenerationParameters {
+    uint32_t generatorVersion;
+    uint32_t snapshotVersion;
+    int32_t numStars;
+    uint32_t seed;
+    float galaxyRadius;
+    float maxVelocity;
+    float flatRotationVelocity;
+    float radiusMin, radiusMax;
+    float heightMin, heightMax;
+    float angleMin, angleMax;
+};
+
+uint64_t generationParametersHash(const SimulationContext& ctx) {
+    GenerationParameters parameters;
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.generatorVersion = GENERATOR_VERSION;
+    parameters.snapshotVersion = SNAPSHOT_VERSION;
+    parameters.numStars = NUM_STARS;
+    parameters.seed = ctx.seed;
+    parameters.galaxyRadius = GALAXY_RADIUS;
+    parameters.maxVelocity = MAX_VELOCITY;
+    parameters.flatRotationVelocity = FLAT_ROTATION_VELOCITY;
+    parameters.radiusMin = radiusDistribution.a();
+    parameters.radiusMax = radiusDistribution.b();
+    parameters.heightMin = heightDistribution.a();
+    parameters.heightMax = heightDistribution.b();
+    parameters.angleMin = angleDistribution.a();
+    parameters.angleMax = angleDistribution.b();
+    return snapshotChecksum(&parameters, sizeof(parameters));
+}
+
+std::filesystem::path initialConditionsCachePath(const SimulationContext& ctx) {
+    char name[64];
+    snprintf(name, sizeof(name), "ic_%016llx.rdesnap", (unsigned long long)generationParametersHash(ctx));
+    return std::filesystem::path(cacheDirectory) / name;
+}
+
+// Remove least recently used cache files until the cache fits its limits. The
+// entry just written is kept even when it alone exceeds them.
+void evictInitialConditionsCache(const std::filesystem::path& keep) {
+    struct CacheEntry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type lastUsed;
+        uint64_t bytes;
+    };
+
+    std::error_code error;
+    std::vector<CacheEntry> entries;
+    uint64_t totalBytes = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(cacheDirectory, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 3, "ic_") != 0 || entry.path().extension() != ".rdesnap") continue;
+        if (entry.path() == keep) continue;
+        CacheEntry cacheEntry = { entry.path(), entry.last_write_time(error), (uint64_t)entry.file_size(error) };
+        totalBytes += cacheEntry.bytes;
+        entries.push_back(cacheEntry);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) {
+        return a.lastUsed < b.lastUsed;
+    });
+
+    size_t remaining = entries.size();
+    uint64_t keptBytes = std::filesystem::file_size(keep, error);
+    if (!error) {
+        totalBytes += keptBytes;
+        remaining++;
+    }
+    for (const CacheEntry& entry : entries) {
+        if (totalBytes <= cacheMaxBytes && remaining <= (size_t)cacheMaxEntries) break;
+        if (std::filesystem::remove(entry.path, error)) {
+            std::cout << "Evicted cached catalog " << entry.path.string() << std::endl;
+            totalBytes -= entry.bytes;
+            remaining--;
+        }
+    }
+}
+
+// Generate the stars, or load them from the cache when a matching catalog exists
+void initializeStarsCached(SimulationContext& ctx) {
+    if (cacheDirectory.empty() || !ctx.seedFixed) {
+        initializeStars(ctx, ctx.seed);
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+    std::filesystem::path path = initialConditionsCachePath(ctx);
+
+    if (std::filesystem::exists(path, error)) {
+        // The modification time doubles as the last-used time for eviction
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        std::string state;
+        if (loadSnapshot(ctx, path.string(), verifySnapshotChecksums, &state)) {
+            std::istringstream generatorState(state);
+            generatorState >> ctx.gen;
+            if (!generatorState.fail()) return;
+        }
+        std::filesystem::remove(path, error);
+    }
+
+    initializeStars(ctx, ctx.seed);
+
+    // Write under a temporary name unique to this run, so concurrent runs never
+    // write into the same file and never see a partial one
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", (unsigned int)rd(), (unsigned int)rd());
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += suffix;
+    // Cache entries are always stored exactly; --compress-tolerance only applies to saved snapshots
+    std::ostringstream generatorState;
+    generatorState << ctx.gen;
+    if (writeSnapshot(temporaryPath.string(), ctx.keplerianStars.data(), ctx.flatRotationStars.data(), ctx.keplerianStars.size(),
+        ctx.observerVelocity, 0.0f, generatorState.str())) {
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error) std::filesystem::remove(temporaryPath, error);
+    }
+    evictInitialConditionsCache(path);
+}
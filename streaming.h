@@ -0,0 +1,282 @@
+#pragma once
+// Out-of-core analysis of snapshots too large to load
+
+// Out-of-core streaming
+// Walks a snapshot in chunks of streamChunkStars stars. Only the current chunk's
+// column windows and the next chunk, which a background task maps and faults in
+// while the current one is processed, are resident at any time, so memory use is
+// bounded by the chunk size rather than by the catalog size.
+std::string streamRenderPath;
+std::string renderOutputPath = "render.ppm";
+size_t streamChunkStars = 4 << 20;
+bool streamWithReads = false; // read chunks into buffers with AsyncFileIO instead of mapping them
+
+struct SnapshotChunk {
+    size_t firstStar = 0;
+    size_t count = 0;
+    const float* columns[MODEL_COUNT][FIELD_COUNT][3] = {}; // positions and velocities only
+    std::vector<MappedWindow> windows; // mapped chunks
+    std::vector<float> storage;        // chunks read into memory
+};
+
+// Map one chunk of every position and velocity column and read its pages. When
+// checksums are given, the read doubles as an incremental checksum of each column.
+bool mapSnapshotChunk(const MappedFile& file, const SnapshotHeader& header, const int located[MODEL_COUNT][FIELD_COUNT][3],
+    size_t firstStar, size_t count, uint64_t* checksums, SnapshotChunk& chunk) {
+    chunk.firstStar = firstStar;
+    chunk.count = count;
+    chunk.windows.clear();
+    unsigned char touched = 0;
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        for (int field = FIELD_POSITION; field <= FIELD_VELOCITY; field++) {
+            for (int component = 0; component < 3; component++) {
+                int c = located[model][field][component];
+                const SnapshotColumn& column = header.columns[c];
+                MappedWindow window;
+                if (!file.mapWindow(column.offset + firstStar * sizeof(float), count * sizeof(float), window)) {
+                    return false;
+                }
+                if (checksums) {
+                    checksums[c] = snapshotChecksum(window.data, count * sizeof(float), checksums[c]);
+                }
+                else {
+                    for (size_t offset = 0; offset < count * sizeof(float); offset += 4096) {
+                        touched ^= window.data[offset];
+                    }
+                }
+                chunk.columns[model][field][component] = reinterpret_cast<const float*>(window.data);
+                chunk.windows.push_back(std::move(window));
+            }
+        }
+    }
+    prefetchSink += touched;
+    return true;
+}
+
+// Queue reads of one chunk of every position and velocity column into the chunk's buffer
+void readSnapshotChunk(AsyncFileIO& io, const SnapshotHeader& header, const int located[MODEL_COUNT][FIELD_COUNT][3],
+    size_t firstStar, size_t count, SnapshotChunk& chunk, std::vector<uint64_t>& tickets) {
+    chunk.firstStar = firstStar;
+    chunk.count = count;
+    chunk.windows.clear();
+    chunk.storage.resize(count * MODEL_COUNT * 2 * 3);
+    tickets.clear();
+    float* destination = chunk.storage.data();
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        for (int field = FIELD_POSITION; field <= FIELD_VELOCITY; field++) {
+            for (int component = 0; component < 3; component++) {
+                const SnapshotColumn& column = header.columns[located[model][field][component]];
+                tickets.push_back(io.submitRead(column.offset + firstStar * sizeof(float), destination, count * sizeof(float)));
+                chunk.columns[model][field][component] = destination;
+                destination += count;
+            }
+        }
+    }
+}
+
+// Call processChunk(chunk) for consecutive chunks of a snapshot, prefetching the next one
+template <typename Function>
+bool streamSnapshot(const std::string& path, bool verifyChecksums, SnapshotHeader& header, Function processChunk) {
+    MappedFile file;
+    MappedWindow headerWindow;
+    if (!file.open(path, false) || !file.mapWindow(0, std::min<uint64_t>(file.size, sizeof(SnapshotHeader)), headerWindow)) {
+        std::cerr << "Cannot open snapshot " << path << std::endl;
+        return false;
+    }
+    int located[MODEL_COUNT][FIELD_COUNT][3];
+    bool haveDopplerColors;
+    if (!readSnapshotHeader(path, headerWindow.data, std::min<uint64_t>(file.size, sizeof(SnapshotHeader)), header) ||
+        !locateSnapshotColumns(path, header, file.size, located, haveDopplerColors)) {
+        return false;
+    }
+    headerWindow.unmap();
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        for (int field = FIELD_POSITION; field <= FIELD_VELOCITY; field++) {
+            for (int component = 0; component < 3; component++) {
+                if (header.columns[located[model][field][component]].codec != CODEC_RAW) {
+                    std::cerr << "Snapshot " << path << " is compressed; streaming needs raw columns" << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    uint64_t checksums[SNAPSHOT_MAX_COLUMNS];
+    for (int c = 0; c < SNAPSHOT_MAX_COLUMNS; c++) {
+        checksums[c] = snapshotChecksum(nullptr, 0);
+    }
+    uint64_t* runningChecksums = verifyChecksums ? checksums : nullptr;
+
+    // Even chunk sizes keep every chunk but the last a multiple of 8 bytes per column
+    size_t starCount = (size_t)header.starCount;
+    size_t chunkStars = std::max<size_t>(streamChunkStars & ~(size_t)1, 2);
+
+    AsyncFileIO io;
+    if (streamWithReads && !io.open(path, false)) {
+        std::cerr << "Cannot open snapshot " << path << std::endl;
+        return false;
+    }
+    std::vector<uint64_t> tickets;
+
+    // Mapped chunks are faulted in by a background task; read chunks are queued
+    // with AsyncFileIO and complete on their own while the current chunk is processed
+    auto fetchChunk = [&](size_t first, SnapshotChunk& chunk) {
+        size_t count = std::min(chunkStars, starCount - first);
+        if (!streamWithReads) {
+            return mapSnapshotChunk(file, header, located, first, count, runningChecksums, chunk);
+        }
+        readSnapshotChunk(io, header, located, first, count, chunk, tickets);
+        return true;
+    };
+    auto completeChunk = [&](SnapshotChunk& chunk) {
+        if (!streamWithReads) return true;
+        bool ok = true;
+        for (uint64_t ticket : tickets) {
+            ok = io.wait(ticket) && ok;
+        }
+        if (ok && runningChecksums) {
+            for (int model = 0; model < MODEL_COUNT; model++) {
+                for (int field = FIELD_POSITION; field <= FIELD_VELOCITY; field++) {
+                    for (int component = 0; component < 3; component++) {
+                        int c = located[model][field][component];
+                        checksums[c] = snapshotChecksum(chunk.columns[model][field][component], chunk.count * sizeof(float), checksums[c]);
+                    }
+                }
+            }
+        }
+        return ok;
+    };
+
+    SnapshotChunk chunks[2];
+    int current = 0;
+    if (starCount > 0 && !(fetchChunk(0, chunks[0]) && completeChunk(chunks[0]))) {
+        std::cerr << "Cannot read snapshot " << path << std::endl;
+        return false;
+    }
+    for (size_t first = 0; first < starCount; first += chunkStars) {
+        size_t next = first + chunkStars;
+        SnapshotChunk& nextChunk = chunks[current ^ 1];
+        std::future<bool> prefetch;
+        if (next < starCount) {
+            if (streamWithReads) {
+                fetchChunk(next, nextChunk);
+            }
+            else {
+                prefetch = std::async(std::launch::async, [&]() { return fetchChunk(next, nextChunk); });
+            }
+        }
+
+        processChunk(chunks[current]);
+
+        bool ok = true;
+        if (prefetch.valid()) ok = prefetch.get();
+        if (ok && next < starCount) ok = completeChunk(nextChunk);
+        if (!ok) {
+            std::cerr << "Cannot read snapshot " << path << std::endl;
+            return false;
+        }
+        chunks[current].windows.clear(); // releases the processed chunk's mappings
+        current ^= 1;
+    }
+
+    if (verifyChecksums) {
+        for (int model = 0; model < MODEL_COUNT; model++) {
+            for (int field = FIELD_POSITION; field <= FIELD_VELOCITY; field++) {
+                for (int component = 0; component < 3; component++) {
+                    int c = located[model][field][component];
+                    if (checksums[c] != header.columns[c].checksum) {
+                        std::cerr << "Checksum mismatch in snapshot column " << header.columns[c].id << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Evaluate Doppler colours and render both models from a snapshot without loading it
+bool runStreamRender(const SimulationContext& ctx) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    int panelWidth = windowWidth / 2;
+    glm::mat4 viewProjection = panelViewProjection(panelWidth, windowHeight);
+    glm::vec3 observerVel(0.0f, 0.0f, ctx.observerVelocity);
+
+    unsigned int workers = workerThreadCount(ctx.threads);
+    std::vector<SoftwareFramebuffer> framebuffers(workers);
+    for (auto& framebuffer : framebuffers) {
+        framebuffer.resize(windowWidth, windowHeight);
+    }
+    std::vector<double> dopplerSums(workers * MODEL_COUNT, 0.0);
+
+    // Moment maps are binned in the same pass when requested
+    bool moments = !momentMapPrefix.empty();
+    SkyGrid sky(momentMapSize);
+    std::vector<MomentGrid> momentGrids[MODEL_COUNT];
+    for (int model = 0; moments && model < MODEL_COUNT; model++) {
+        momentGrids[model].resize(workers);
+        for (auto& grid : momentGrids[model]) {
+            grid.resize(momentMapSize);
+        }
+    }
+
+    SnapshotHeader header;
+    bool ok = streamSnapshot(streamRenderPath, verifySnapshotChecksums, header, [&](const SnapshotChunk& chunk) {
+        parallelFor(ctx.threads, chunk.count, [&](size_t begin, size_t end, unsigned int worker) {
+            SoftwareFramebuffer& framebuffer = framebuffers[worker];
+            for (int model = 0; model < MODEL_COUNT; model++) {
+                const float* const* position = chunk.columns[model][FIELD_POSITION];
+                const float* const* velocity = chunk.columns[model][FIELD_VELOCITY];
+                double dopplerSum = 0.0;
+                for (size_t i = begin; i < end; i++) {
+                    float rgb[3];
+                    float radialVelocity;
+                    dopplerSum += dopplerShiftedStarColor(glm::vec3(velocity[0][i], velocity[1][i], velocity[2][i]),
+                        observerVel, rgb, &radialVelocity);
+                    splatStar(framebuffer, model * panelWidth, panelWidth, viewProjection,
+                        glm::vec3(position[0][i], position[1][i], position[2][i]), rgb, radialVelocity);
+                }
+                dopplerSums[worker * MODEL_COUNT + model] += dopplerSum;
+                if (moments) {
+                    depositMoments(momentGrids[model][worker], sky, observerVel, begin, end,
+                        [&](size_t i, glm::vec3& p, glm::vec3& v) {
+                            p = glm::vec3(position[0][i], position[1][i], position[2][i]);
+                            v = glm::vec3(velocity[0][i], velocity[1][i], velocity[2][i]);
+                        });
+                }
+            }
+        });
+    });
+    if (!ok) {
+        return false;
+    }
+
+    for (unsigned int worker = 1; worker < workers; worker++) {
+        mergeFramebuffer(framebuffers[0], framebuffers[worker]);
+    }
+    bool written = hasExtension(renderOutputPath, ".fits") ? writeFramebufferFits(renderOutputPath, framebuffers[0], header.starCount, ctx.observerVelocity)
+        : writePPM(renderOutputPath, framebuffers[0]);
+    if (!written) {
+        return false;
+    }
+    for (int model = 0; moments && model < MODEL_COUNT; model++) {
+        mergeMomentGrids(momentGrids[model]);
+        if (!writeMomentMaps(momentMapPrefix, model == MODEL_KEPLERIAN ? "keplerian" : "flat", momentGrids[model][0], sky, ctx.observerVelocity)) {
+            return false;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    for (int model = 0; model < MODEL_COUNT; model++) {
+        double sum = 0.0;
+        for (unsigned int worker = 0; worker < workers; worker++) {
+            sum += dopplerSums[worker * MODEL_COUNT + model];
+        }
+        std::cout << (model == MODEL_KEPLERIAN ? "Keplerian" : "Flat rotation") << " mean Doppler factor: "
+            << (header.starCount ? sum / header.starCount : 0.0) << std::endl;
+    }
+    std::cout << "Streamed " << header.starCount << " stars in " << seconds << " s ("
+        << header.starCount / seconds / 1e6 << " M stars/s), wrote " << renderOutputPath << std::endl;
+    return true;
+}
@@ -0,0 +1,185 @@
+#pragma once
+// Worker threads: the persistent pool behind parallelFor() and workStealingFor()
+
+// Worker threads
+unsigned int workerThreads = 0; // --threads, 0 = one per hardware thread; only set while parsing
+
+// Workers for a loop that asks for `requested` of them, 0 meaning the --threads default
+unsigned int workerThreadCount(unsigned int requested = 0) {
+    if (requested > 0) return requested;
+    if (workerThreads > 0) return workerThreads;
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    return hardwareThreads > 0 ? hardwareThreads : 1;
+}
+
+// Worker pool
+// Persistent threads that run the ranges of parallelFor() and the workers of
+// workStealingFor(), so neither pays for creating and joining threads on every
+// call and profiler rings and trace tracks belong to long-lived workers. The
+// pool grows to the largest number of helpers asked for and its threads live
+// until exit. run() hands job 0 to the calling thread and, while it waits,
+// has it run queued jobs too, so parallel loops may nest and several threads
+// may submit at once without deadlocking.
+class WorkerPool {
+public:
+    WorkerPool() {}
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Start threads until the pool has at least count of them
+    void reserve(size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (threads.size() < count) {
+            threads.emplace_back([this]() { threadLoop(); });
+        }
+    }
+
+    // Queue task for the next free pool thread
+    void post(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(task));
+        }
+        changed.notify_all();
+    }
+
+    // Call job(index) for every index in [0, jobs) and return when all are done
+    template <typename Job>
+    void run(size_t jobs, Job& job) {
+        if (jobs == 0) return;
+        reserve(jobs - 1);
+        size_t remaining = jobs - 1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t index = 1; index < jobs; index++) {
+                queue.push_back([this, &job, &remaining, index]() {
+                    job(index);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    remaining--;
+                });
+            }
+        }
+        changed.notify_all();
+        job(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (remaining > 0) {
+            if (!queue.empty()) {
+                runFront(lock);
+                continue;
+            }
+            changed.wait(lock);
+        }
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable changed; // a task was queued or finished
+    bool stopping = false;
+
+    // Run the task at the front of the queue with the lock released around it
+    void runFront(std::unique_lock<std::mutex>& lock) {
+        std::function<void()> task = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+        changed.notify_all();
+    }
+
+    void threadLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            changed.wait(lock, [&]() { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            runFront(lock);
+        }
+    }
+};
+
+WorkerPool workerPool;
+
+// Split [0, count) into one contiguous range per worker and call
+// fn(begin, end, worker) for each range in parallel on `threads` workers
+// (0 = the --threads default)
+template <typename Function>
+void parallelFor(unsigned int threads, size_t count, Function fn) {
+    size_t workers = std::min<size_t>(workerThreadCount(threads), std::max<size_t>(count, 1));
+    auto range = [&](size_t worker) {
+        PhaseTimer timer(PHASE_TASK);
+        fn(count * worker / workers, count * (worker + 1) / workers, (unsigned int)worker);
+    };
+    workerPool.run(workers, range);
+}
+
+template <typename Function>
+void parallelFor(size_t count, Function fn) {
+    parallelFor(0u, count, fn);
+}
+
+// Call fn(task, worker) for every task in [0, count) when tasks differ widely in
+// cost. Each worker starts with a contiguous range in its own queue and takes
+// tasks from the front; a worker whose queue runs dry steals from the back of
+// another's. No tasks are added once started, so a worker finding every queue
+// empty is done. Returns the number of stolen tasks.
+template <typename Function>
+size_t workStealingFor(unsigned int threads, size_t count, Function fn) {
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+    size_t workers = std::min<size_t>(workerThreadCount(threads), std::max<size_t>(count, 1));
+    std::vector<TaskQueue> queues(workers);
+    for (size_t worker = 0; worker < workers; worker++) {
+        for (size_t task = count * worker / workers; task < count * (worker + 1) / workers; task++) {
+            queues[worker].tasks.push_back(task);
+        }
+    }
+
+    std::atomic<size_t> steals(0);
+    auto run = [&](size_t worker) {
+        for (;;) {
+            size_t task = 0;
+            bool found = false;
+            for (size_t offset = 0; offset < workers && !found; offset++) {
+                TaskQueue& queue = queues[(worker + offset) % workers];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) continue;
+                if (offset == 0) {
+                    task = queue.tasks.front();
+                    queue.tasks.pop_front();
+                }
+                else {
+                    task = queue.tasks.back();
+                    queue.tasks.pop_back();
+                    steals++;
+                }
+                found = true;
+            }
+            if (!found) return;
+            PhaseTimer timer(PHASE_TASK);
+            fn(task, (unsigned int)worker);
+        }
+    };
+
+    workerPool.run(workers, run);
+    return steals;
+}
+
+template <typename Function>
+size_t workStealingFor(size_t count, Function fn) {
+    return workStealingFor(0u, count, fn);
+}